@@ -0,0 +1,316 @@
+// Producer/consumer benchmark harness.
+//
+// Sweeps buffer size, producer/consumer counts and item counts over every
+// selected synchronization engine and prints one CSV row per configuration.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bounded_buffer.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+/// What travels through the queue: enough to measure latency and check order.
+struct bench_item {
+  uint64_t enqueued; ///< trace_now() taken just before put().
+  int producer;
+  int seq;
+};
+
+/// One point of the sweep.
+struct bench_config {
+  int capacity;
+  int producers;
+  int consumers;
+  int items;
+};
+
+/// Measurements for one point of the sweep.
+struct bench_result {
+  double seconds;
+  uint64_t p50, p99, p999; ///< put()-to-get() latency in nanoseconds.
+  double cpu; ///< User plus system CPU seconds.
+  long voluntary, involuntary; ///< Context switches from getrusage.
+};
+
+/// Classic monitor: one pthread mutex and two condition variables.
+class monitor_queue {
+public:
+  explicit monitor_queue(int capacity) : slots(capacity), in(0), out(0), count(0) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&notFull, NULL);
+    pthread_cond_init(&notEmpty, NULL);
+  }
+  ~monitor_queue() {
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&notFull);
+    pthread_cond_destroy(&notEmpty);
+  }
+
+  void put(bench_item &&item) {
+    pthread_mutex_lock(&lock);
+    while (count == slots.size()) {
+      pthread_cond_wait(&notFull, &lock);
+    }
+    slots[in] = item;
+    in = (in + 1) % slots.size();
+    count++;
+    pthread_cond_signal(&notEmpty);
+    pthread_mutex_unlock(&lock);
+  }
+
+  void get(bench_item &item) {
+    pthread_mutex_lock(&lock);
+    while (count == 0) {
+      pthread_cond_wait(&notEmpty, &lock);
+    }
+    item = slots[out];
+    out = (out + 1) % slots.size();
+    count--;
+    pthread_cond_signal(&notFull);
+    pthread_mutex_unlock(&lock);
+  }
+
+private:
+  std::vector<bench_item> slots;
+  size_t in, out, count;
+  pthread_mutex_t lock;
+  pthread_cond_t notFull, notEmpty;
+};
+
+/// bounded_buffer with a fixed wait policy, so it fits the engine table.
+template <wait_policy Policy>
+class policy_buffer : public bounded_buffer<bench_item> {
+public:
+  explicit policy_buffer(int capacity) : bounded_buffer<bench_item>(capacity, -1, Policy) {}
+};
+
+/// Shared state of one run. Producers and consumers claim tickets up front so
+/// each thread knows exactly how many put()/get() calls it owes and no
+/// shutdown signalling is needed.
+template <typename Queue>
+struct bench_run {
+  Queue queue;
+  int items;
+  std::atomic<int> produced, consumed;
+  std::vector<std::vector<uint64_t> > latencies; ///< One vector per consumer.
+
+  bench_run(const bench_config &cfg)
+      : queue(cfg.capacity), items(cfg.items), produced(0), consumed(0),
+        latencies(cfg.consumers) {}
+};
+
+template <typename Queue>
+struct bench_thread {
+  bench_run<Queue> *run;
+  int id;
+};
+
+template <typename Queue>
+void *bench_producer(void *arg) {
+  bench_thread<Queue> *self = (bench_thread<Queue> *)arg;
+  bench_run<Queue> *run = self->run;
+  int seq;
+
+  while ((seq = run->produced.fetch_add(1)) < run->items) {
+    bench_item item;
+    item.producer = self->id;
+    item.seq = seq;
+    item.enqueued = trace_now();
+    run->queue.put(std::move(item));
+  }
+  return NULL;
+}
+
+template <typename Queue>
+void *bench_consumer(void *arg) {
+  bench_thread<Queue> *self = (bench_thread<Queue> *)arg;
+  bench_run<Queue> *run = self->run;
+  std::vector<uint64_t> &lat = run->latencies[self->id];
+
+  while (run->consumed.fetch_add(1) < run->items) {
+    bench_item item = bench_item();
+    run->queue.get(item);
+    lat.push_back(trace_now() - item.enqueued);
+  }
+  return NULL;
+}
+
+/// Value at quantile q of a sorted sample.
+inline uint64_t percentile(const std::vector<uint64_t> &sorted, double q) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = (size_t)(q * (sorted.size() - 1));
+  return sorted[idx];
+}
+
+/// Runs one configuration on one engine.
+template <typename Queue>
+bench_result bench_one(const bench_config &cfg) {
+  bench_run<Queue> run(cfg);
+  std::vector<pthread_t> threads(cfg.producers + cfg.consumers);
+  std::vector<bench_thread<Queue> > args(threads.size());
+  for (size_t i = 0; i < run.latencies.size(); i++) {
+    run.latencies[i].reserve(cfg.items / cfg.consumers + 1);
+  }
+
+  run_stats stats;
+  stats_start(&stats);
+
+  for (size_t i = 0; i < threads.size(); i++) {
+    bool isProducer = (int)i < cfg.producers;
+    args[i].run = &run;
+    args[i].id = isProducer ? i : i - cfg.producers;
+    if (pthread_create(&threads[i], NULL, isProducer ? bench_producer<Queue> : bench_consumer<Queue>, &args[i])) {
+      fprintf(stderr, "Creation of benchmark thread %zu failed!\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  stats_stop(&stats);
+
+  std::vector<uint64_t> all;
+  all.reserve(cfg.items);
+  for (size_t i = 0; i < run.latencies.size(); i++) {
+    all.insert(all.end(), run.latencies[i].begin(), run.latencies[i].end());
+  }
+  std::sort(all.begin(), all.end());
+
+  bench_result res;
+  res.seconds = stats_elapsed(&stats);
+  res.p50 = percentile(all, 0.50);
+  res.p99 = percentile(all, 0.99);
+  res.p999 = percentile(all, 0.999);
+  res.cpu = stats_cpu(&stats);
+  res.voluntary = stats.stopUsage.ru_nvcsw - stats.startUsage.ru_nvcsw;
+  res.involuntary = stats.stopUsage.ru_nivcsw - stats.startUsage.ru_nivcsw;
+  return res;
+}
+
+typedef bench_result (*engine_fn)(const bench_config &);
+
+/// Engines selectable with -e.
+struct engine_entry {
+  const char *name;
+  engine_fn run;
+};
+
+engine_entry engines[] = {
+  {"sem", bench_one<policy_buffer<wait_policy::block> >},
+  {"spin", bench_one<policy_buffer<wait_policy::spin> >},
+  {"adaptive", bench_one<policy_buffer<wait_policy::adaptive> >},
+  {"monitor", bench_one<monitor_queue>},
+};
+const int numEngines = sizeof(engines) / sizeof(engine_entry);
+
+/// Splits a comma-separated list of names.
+std::vector<std::string> split_list(const char *arg) {
+  std::vector<std::string> out;
+  std::string cur;
+  for (const char *p = arg; ; p++) {
+    if (*p == ',' || *p == '\0') {
+      if (!cur.empty()) {
+        out.push_back(cur);
+      }
+      cur.clear();
+      if (*p == '\0') {
+        break;
+      }
+    } else {
+      cur += *p;
+    }
+  }
+  return out;
+}
+
+/// Splits a comma-separated list of positive integers.
+std::vector<int> split_ints(const char *arg) {
+  std::vector<std::string> names = split_list(arg);
+  std::vector<int> out;
+  for (size_t i = 0; i < names.size(); i++) {
+    out.push_back(atoi(names[i].c_str()));
+  }
+  return out;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-e <engine,...>] [-b <sizes>] [-p <counts>] [-c <counts>] [-i <counts>] [-r <repeats>]\n", prog);
+  fprintf(stderr, "\tlists are comma separated, e.g. -b 1,8,64\n");
+  fprintf(stderr, "\tengines:");
+  for (int i = 0; i < numEngines; i++) {
+    fprintf(stderr, " %s", engines[i].name);
+  }
+  fprintf(stderr, "\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> names = split_list("sem,spin,adaptive,monitor");
+  std::vector<int> sizes = split_ints("1,8,64,512");
+  std::vector<int> prods = split_ints("1,4");
+  std::vector<int> cons = split_ints("1,4");
+  std::vector<int> counts = split_ints("100000");
+  int repeats = 1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "e:b:p:c:i:r:")) != -1) {
+    switch (opt) {
+      case 'e': names = split_list(optarg); break;
+      case 'b': sizes = split_ints(optarg); break;
+      case 'p': prods = split_ints(optarg); break;
+      case 'c': cons = split_ints(optarg); break;
+      case 'i': counts = split_ints(optarg); break;
+      case 'r': repeats = atoi(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+
+  std::vector<engine_entry *> selected;
+  for (size_t n = 0; n < names.size(); n++) {
+    int e = 0;
+    while (e < numEngines && names[n] != engines[e].name) {
+      e++;
+    }
+    if (e == numEngines) {
+      fprintf(stderr, "Unknown engine '%s'\n", names[n].c_str());
+      usage(argv[0]);
+    }
+    selected.push_back(&engines[e]);
+  }
+
+  printf("engine,buffer,producers,consumers,items,seconds,items_per_sec,p50_ns,p99_ns,p999_ns,cpu_s,voluntary_csw,involuntary_csw\n");
+  for (size_t e = 0; e < selected.size(); e++)
+  for (size_t b = 0; b < sizes.size(); b++)
+  for (size_t p = 0; p < prods.size(); p++)
+  for (size_t c = 0; c < cons.size(); c++)
+  for (size_t i = 0; i < counts.size(); i++)
+  for (int r = 0; r < repeats; r++) {
+    bench_config cfg = {sizes[b], prods[p], cons[c], counts[i]};
+    if (cfg.capacity < 1 || cfg.producers < 1 || cfg.consumers < 1 || cfg.items < 0) {
+      usage(argv[0]);
+    }
+    bench_result res = selected[e]->run(cfg);
+    printf("%s,%d,%d,%d,%d,%.6f,%.0f,%llu,%llu,%llu,%.6f,%ld,%ld\n",
+           selected[e]->name, cfg.capacity, cfg.producers, cfg.consumers, cfg.items,
+           res.seconds, res.seconds > 0 ? cfg.items / res.seconds : 0.0,
+           (unsigned long long)res.p50, (unsigned long long)res.p99, (unsigned long long)res.p999,
+           res.cpu, res.voluntary, res.involuntary);
+    fflush(stdout);
+  }
+
+  return 0;
+}
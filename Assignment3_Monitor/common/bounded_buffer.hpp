@@ -0,0 +1,245 @@
+#ifndef BOUNDED_BUFFER_HPP
+#define BOUNDED_BUFFER_HPP
+
+#include <semaphore.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+#include "wait_sem.hpp"
+
+/// No-op slot callback for callers that do not trace.
+struct ignore_slot {
+  template <typename T>
+  void operator()(const T &, int) const {}
+};
+
+/// Ring of `capacity` slots of T guarded by counting semaphores and a mutex.
+/// The slot semaphores wait according to a wait_policy.
+///
+/// Items are moved in and out, never copied, so T may be a move-only handle.
+///
+/// The stream ends with close(): put_n() then returns 0, and get_n() drains
+/// what is left and then returns 0. Closing releases every blocked thread
+/// with one wake-up per semaphore; no permits are posted to signal the end,
+/// so no consumer wakes up to find nothing and go back to sleep. The buffer
+/// can also close itself after a fixed number of items: once `limit` items
+/// have gone in and been published, it closes. A negative limit means only
+/// an explicit close() ends the stream.
+template <typename T>
+class bounded_buffer {
+public:
+  explicit bounded_buffer(int capacity, int limit = -1, wait_policy policy = wait_policy::block)
+      : slots(new T[capacity]), cap(capacity), in(0), out(0),
+        limit(limit), produced(0), notEmptyFd(-1), notFullFd(-1),
+        published(0), closed(false),
+        empty(capacity, policy), full(0, policy) {
+    sem_init(&mutex, 0, 1);
+    if (limit == 0) {
+      close();
+    }
+  }
+
+  ~bounded_buffer() {
+    delete[] slots;
+    sem_destroy(&mutex);
+    if (notEmptyFd >= 0) {
+      ::close(notEmptyFd);
+    }
+    if (notFullFd >= 0) {
+      ::close(notFullFd);
+    }
+  }
+
+  bounded_buffer(const bounded_buffer &) = delete;
+  bounded_buffer &operator=(const bounded_buffer &) = delete;
+
+  int capacity() const { return cap; }
+
+  /// Moves up to n items from the front of `items` in with a single slot
+  /// reservation and a single critical section. on_slot(item, slot) runs
+  /// inside the critical section for each item. Returns the number taken,
+  /// which is at least 1 unless the buffer is closed.
+  template <typename F>
+  int put_n(T *items, int n, F on_slot) {
+    int reserved = empty.wait_up_to(n);
+    return reserved ? put_reserved(items, reserved, on_slot) : 0;
+  }
+
+  int put_n(T *items, int n) { return put_n(items, n, ignore_slot()); }
+
+  /// Moves one item in. Returns false once the buffer is closed.
+  bool put(T &&item) { return put_n(&item, 1) == 1; }
+
+  /// Like put_n() but never waits: returns 0 if the buffer is full and -1
+  /// if it is closed.
+  template <typename F>
+  int try_put_n(T *items, int n, F on_slot) {
+    int reserved = empty.try_wait_up_to(n);
+    if (!reserved) {
+      return empty.drained() ? -1 : 0;
+    }
+    int count = put_reserved(items, reserved, on_slot);
+    return count ? count : -1;
+  }
+
+  int try_put_n(T *items, int n) { return try_put_n(items, n, ignore_slot()); }
+
+  /// Moves up to n items out into `items` with a single reservation and a
+  /// single critical section. on_slot(item, slot) runs inside the critical
+  /// section for each item. Returns the number taken, which is at least 1
+  /// unless the buffer is closed and drained.
+  template <typename F>
+  int get_n(T *items, int n, F on_slot) {
+    int count = full.wait_up_to(n);
+    return count ? get_reserved(items, count, on_slot) : 0;
+  }
+
+  int get_n(T *items, int n) { return get_n(items, n, ignore_slot()); }
+
+  /// Moves one item out. Returns false once the buffer is closed and drained.
+  bool get(T &item) { return get_n(&item, 1) == 1; }
+
+  /// Like get_n() but never waits: returns 0 if the buffer is empty and -1
+  /// once it is closed and drained.
+  template <typename F>
+  int try_get_n(T *items, int n, F on_slot) {
+    int count = full.try_wait_up_to(n);
+    if (!count) {
+      return full.drained() ? -1 : 0;
+    }
+    return get_reserved(items, count, on_slot);
+  }
+
+  int try_get_n(T *items, int n) { return try_get_n(items, n, ignore_slot()); }
+
+  /// Ends the stream. Call it once every producer is done putting (puts that
+  /// race with close() may or may not get in); consumers still drain what
+  /// the buffer holds.
+  void close() {
+    sem_wait(&mutex);
+    closed = true;
+    sem_post(&mutex);
+    empty.close();
+    full.close();
+    notify(notEmptyFd);
+    notify(notFullFd);
+  }
+
+  /// Creates eventfd descriptors that become readable when the buffer goes
+  /// from empty to non-empty and from full to non-full, and when it closes,
+  /// so an epoll loop can wait on many buffers next to sockets and timers.
+  /// Call it before any thread uses the buffer. Returns false if eventfd
+  /// fails.
+  ///
+  /// Only transitions of the slot semaphores are signaled (a post that finds
+  /// no permits), and signals that pile up before the loop gets round to
+  /// them coalesce into one readable event; register with EPOLLET. Call
+  /// ack() on the descriptor before draining with try_get_n()/try_put_n()
+  /// until they return 0, so a transition that races the drain is never
+  /// lost.
+  bool enable_events() {
+    notEmptyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    notFullFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (full.drained()) {
+      notify(notEmptyFd);
+    }
+    return notEmptyFd >= 0 && notFullFd >= 0;
+  }
+
+  int not_empty_fd() const { return notEmptyFd; }
+  int not_full_fd() const { return notFullFd; }
+
+  /// Resets a readiness descriptor after epoll reported it.
+  static void ack(int fd) {
+    uint64_t pending;
+    if (read(fd, &pending, sizeof(pending)) < 0) {
+      // EAGAIN: nothing was pending.
+    }
+  }
+
+private:
+  /// Moves items into `reserved` slots already taken from `empty`.
+  template <typename F>
+  int put_reserved(T *items, int reserved, F on_slot) {
+    sem_wait(&mutex);
+
+    int count = closed ? 0 : limit < 0 || limit - produced >= reserved ? reserved : limit - produced;
+    int first = std::min(count, cap - in);
+    std::move(items, items + first, slots + in);
+    std::move(items + first, items + count, slots);
+    for (int i = 0; i < count; i++) {
+      on_slot(slots[(in + i) % cap], (in + i) % cap);
+    }
+    in = (in + count) % cap;
+    produced += count;
+    bool last = limit >= 0 && !closed && produced == limit;
+    if (last) {
+      closed = true;
+    }
+
+    sem_post(&mutex);
+
+    // Unused slots go back; a producer blocked on a full buffer after the
+    // last item went in is released by closing `empty`.
+    empty.post(reserved - count);
+    if (last) {
+      empty.close();
+      notify(notFullFd);
+    }
+    if (full.post(count) == 0 && count > 0) {
+      notify(notEmptyFd);
+    }
+    // Whoever publishes the final item ends the stream, so no consumer can
+    // see it closed while another producer has yet to post.
+    if (limit >= 0 && count > 0 && published.fetch_add(count) + count == limit) {
+      full.close();
+      notify(notEmptyFd);
+    }
+    return count;
+  }
+
+  /// Moves out the `count` items already taken from `full`.
+  template <typename F>
+  int get_reserved(T *items, int count, F on_slot) {
+    sem_wait(&mutex);
+
+    for (int i = 0; i < count; i++) {
+      int slot = (out + i) % cap;
+      items[i] = std::move(slots[slot]);
+      slots[slot] = T();
+      on_slot(items[i], slot);
+    }
+    out = (out + count) % cap;
+
+    sem_post(&mutex);
+
+    if (empty.post(count) == 0) {
+      notify(notFullFd);
+    }
+    return count;
+  }
+
+  static void notify(int fd) {
+    uint64_t one = 1;
+    if (fd >= 0 && write(fd, &one, sizeof(one)) < 0) {
+      // EAGAIN only if 2^64-2 signals piled up; the fd is readable anyway.
+    }
+  }
+
+  T *slots;
+  int cap;
+  int in, out;
+  int limit, produced;
+  int notEmptyFd, notFullFd;
+  std::atomic<int> published; ///< Items whose full permit has been posted.
+  bool closed;
+  sem_t mutex;
+  wait_sem empty, full;
+};
+
+#endif // BOUNDED_BUFFER_HPP
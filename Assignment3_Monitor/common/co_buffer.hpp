@@ -0,0 +1,330 @@
+#ifndef CO_BUFFER_HPP
+#define CO_BUFFER_HPP
+
+// C++20 coroutines: build with -std=c++20.
+
+#include <pthread.h>
+
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <vector>
+
+/// Fixed pool of threads resuming ready coroutines from one FIFO run queue.
+/// run() returns once every spawned task has finished.
+class co_executor {
+public:
+  explicit co_executor(int threads) : numThreads(threads), live(0), stopping(false) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&nonEmpty, NULL);
+  }
+
+  ~co_executor() {
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&nonEmpty);
+  }
+
+  co_executor(const co_executor &) = delete;
+  co_executor &operator=(const co_executor &) = delete;
+
+  /// Queues h to be resumed by one of the threads.
+  void schedule(std::coroutine_handle<> h) {
+    pthread_mutex_lock(&lock);
+    ready.push_back(h);
+    pthread_cond_signal(&nonEmpty);
+    pthread_mutex_unlock(&lock);
+  }
+
+  /// Counts a new task in; called by co_task.
+  void spawned() { live.fetch_add(1, std::memory_order_relaxed); }
+
+  /// Counts a task out; the last one stops the threads.
+  void finished() {
+    if (live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      pthread_mutex_lock(&lock);
+      stopping = true;
+      pthread_cond_broadcast(&nonEmpty);
+      pthread_mutex_unlock(&lock);
+    }
+  }
+
+  /// Runs the threads until every task has finished. Returns false if a
+  /// thread could not be created.
+  bool run() {
+    if (live.load() == 0) {
+      return true;
+    }
+    std::vector<pthread_t> threads(numThreads);
+    int started = 0;
+    for (; started < numThreads; started++) {
+      if (pthread_create(&threads[started], NULL, worker, this)) {
+        break;
+      }
+    }
+    for (int i = 0; i < started; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    return started == numThreads;
+  }
+
+private:
+  static void *worker(void *arg) {
+    ((co_executor *)arg)->loop();
+    return NULL;
+  }
+
+  void loop() {
+    while (1) {
+      pthread_mutex_lock(&lock);
+      while (ready.empty() && !stopping) {
+        pthread_cond_wait(&nonEmpty, &lock);
+      }
+      if (ready.empty()) {
+        pthread_mutex_unlock(&lock);
+        return;
+      }
+      std::coroutine_handle<> h = ready.front();
+      ready.pop_front();
+      pthread_mutex_unlock(&lock);
+      h.resume();
+    }
+  }
+
+  int numThreads;
+  std::atomic<int> live;
+  bool stopping;
+  std::deque<std::coroutine_handle<> > ready;
+  pthread_mutex_t lock;
+  pthread_cond_t nonEmpty;
+};
+
+/// Fire-and-forget coroutine. It starts suspended; start(exec) hands it to
+/// the executor, and the frame frees itself when the body returns.
+struct co_task {
+  struct promise_type {
+    co_executor *exec = nullptr;
+
+    co_task get_return_object() {
+      return co_task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept {
+      exec->finished();
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  /// Hands the task to exec and queues its first resume.
+  void start(co_executor *exec) {
+    handle.promise().exec = exec;
+    exec->spawned();
+    exec->schedule(handle);
+  }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+/// Bounded buffer whose put() and get() suspend the calling coroutine, not
+/// the thread, so many logical producers and consumers share a few threads.
+///
+/// A waiting coroutine parks a small node in its own frame on the putters or
+/// getters list. Whoever makes room or brings an item finishes the waiter's
+/// operation under the lock (moving its item into the ring, or the oldest
+/// item out to it) before scheduling it, so a resumed coroutine never finds
+/// the buffer changed under it and never has to wait again. After close(),
+/// puts fail and gets drain the ring and then return nothing.
+template <typename T>
+class co_buffer {
+public:
+  /// Called under the lock as items go in ('p') and out ('c').
+  typedef void (*log_fn)(char kind, int id, const T &item, int slot);
+
+  co_buffer(int capacity, co_executor *exec, log_fn log = NULL)
+      : slots(new T[capacity]), cap(capacity), in(0), out(0), count(0),
+        closed(false), putters(), getters(), exec(exec), log(log) {
+    pthread_mutex_init(&lock, NULL);
+  }
+
+  ~co_buffer() {
+    delete[] slots;
+    pthread_mutex_destroy(&lock);
+  }
+
+  co_buffer(const co_buffer &) = delete;
+  co_buffer &operator=(const co_buffer &) = delete;
+
+private:
+  struct waiter {
+    std::coroutine_handle<> handle;
+    T item;
+    bool ok;
+    int id;
+    waiter *next;
+  };
+
+  /// FIFO of suspended coroutines.
+  struct waiter_list {
+    waiter *head = nullptr, *tail = nullptr;
+
+    void push(waiter *w) {
+      w->next = nullptr;
+      (tail ? tail->next : head) = w;
+      tail = w;
+    }
+    waiter *pop() {
+      waiter *w = head;
+      if (w && !(head = w->next)) {
+        tail = nullptr;
+      }
+      return w;
+    }
+  };
+
+public:
+  class put_awaiter {
+  public:
+    put_awaiter(co_buffer *buf, T &&item, int id) : buf(buf) {
+      w.item = std::move(item);
+      w.id = id;
+    }
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h) { return buf->put_or_wait(&w, h); }
+    /// False if the buffer was closed.
+    bool await_resume() { return w.ok; }
+
+  private:
+    co_buffer *buf;
+    waiter w;
+  };
+
+  class get_awaiter {
+  public:
+    get_awaiter(co_buffer *buf, int id) : buf(buf) { w.id = id; }
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h) { return buf->get_or_wait(&w, h); }
+    /// Empty once the buffer is closed and drained.
+    std::optional<T> await_resume() {
+      if (!w.ok) {
+        return std::nullopt;
+      }
+      return std::optional<T>(std::move(w.item));
+    }
+
+  private:
+    co_buffer *buf;
+    waiter w;
+  };
+
+  /// `co_await put(item, id)` moves item in, suspending while the buffer is
+  /// full. id only shows up in the log.
+  put_awaiter put(T item, int id = 0) { return put_awaiter(this, std::move(item), id); }
+
+  /// `co_await get(id)` moves the oldest item out, suspending while the
+  /// buffer is empty.
+  get_awaiter get(int id = 0) { return get_awaiter(this, id); }
+
+  /// Ends the stream and resumes every waiting coroutine.
+  void close() {
+    pthread_mutex_lock(&lock);
+    closed = true;
+    waiter_list p = putters, g = getters;
+    putters = getters = waiter_list();
+    pthread_mutex_unlock(&lock);
+
+    for (waiter *w; (w = p.pop()) || (w = g.pop());) {
+      w->ok = false;
+      exec->schedule(w->handle);
+    }
+  }
+
+private:
+  void push(waiter *w) {
+    slots[in] = std::move(w->item);
+    if (log) {
+      log('p', w->id, slots[in], in);
+    }
+    in = (in + 1) % cap;
+    count++;
+    w->ok = true;
+  }
+
+  void take(waiter *w) {
+    w->item = std::move(slots[out]);
+    slots[out] = T();
+    if (log) {
+      log('c', w->id, w->item, out);
+    }
+    out = (out + 1) % cap;
+    count--;
+    w->ok = true;
+  }
+
+  /// Returns true if the coroutine must stay suspended.
+  bool put_or_wait(waiter *w, std::coroutine_handle<> h) {
+    pthread_mutex_lock(&lock);
+    if (closed) {
+      pthread_mutex_unlock(&lock);
+      w->ok = false;
+      return false;
+    }
+    if (count == cap) {
+      w->handle = h;
+      putters.push(w);
+      pthread_mutex_unlock(&lock);
+      return true;
+    }
+    push(w);
+    // Getters only wait on an empty ring, so this hands them our item.
+    waiter *g = getters.pop();
+    if (g) {
+      take(g);
+    }
+    pthread_mutex_unlock(&lock);
+    if (g) {
+      exec->schedule(g->handle);
+    }
+    return false;
+  }
+
+  bool get_or_wait(waiter *w, std::coroutine_handle<> h) {
+    pthread_mutex_lock(&lock);
+    if (count == 0) {
+      if (closed) {
+        pthread_mutex_unlock(&lock);
+        w->ok = false;
+        return false;
+      }
+      w->handle = h;
+      getters.push(w);
+      pthread_mutex_unlock(&lock);
+      return true;
+    }
+    take(w);
+    // Putters only wait on a full ring, so the slot just freed is theirs.
+    waiter *p = putters.pop();
+    if (p) {
+      push(p);
+    }
+    pthread_mutex_unlock(&lock);
+    if (p) {
+      exec->schedule(p->handle);
+    }
+    return false;
+  }
+
+  T *slots;
+  int cap;
+  int in, out, count;
+  bool closed;
+  waiter_list putters, getters;
+  co_executor *exec;
+  log_fn log;
+  pthread_mutex_t lock;
+};
+
+#endif // CO_BUFFER_HPP
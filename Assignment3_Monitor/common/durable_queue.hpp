@@ -0,0 +1,347 @@
+#ifndef DURABLE_QUEUE_HPP
+#define DURABLE_QUEUE_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// First page of a durable_queue file; the slots start on the next page.
+/// head and tail are only written by a commit, after the slots they cover
+/// have reached the disk.
+struct durable_header {
+  static const uint32_t MAGIC = 0x51525544; // "DURQ"
+
+  uint32_t magic;
+  int capacity;  ///< Number of slots.
+  int slotSize;  ///< Largest item in bytes.
+  uint64_t head; ///< Committed read position.
+  uint64_t tail; ///< Committed write position.
+};
+
+/// Bounded queue of byte items kept in a memory-mapped file so it survives
+/// the process.
+///
+/// Appends land in the mapping straight away but become visible to
+/// consumers, and durable, only at the next group commit: one msync of the
+/// dirty slot pages followed by one of the header page covers every item
+/// appended since the previous commit. A commit runs when `batch` items are
+/// pending, when the `window` since the last one runs out (a background
+/// thread), when producers are blocked on space that only a commit can
+/// free, and on close().
+///
+/// Consumed slots are only reused after their read position has been
+/// committed too, so after a crash reopening the file resumes consumers at
+/// the last committed head: items are delivered at least once.
+///
+/// A failed flush is never counted as durable: the header keeps its old
+/// positions, no further commits run, producers are refused with the
+/// msync error and consumers drain what was committed before it.
+class durable_queue {
+public:
+  /// Opens path, creating it with `capacity` slots of `slot_size` bytes if
+  /// it is missing or empty, and otherwise resuming what it holds (the size
+  /// arguments are then ignored). Returns NULL with errno set on failure.
+  static durable_queue *open(const char *path, int capacity, int slot_size, int batch, long window_us) {
+    int fd = ::open(path, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+      return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      return fail(fd, errno);
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    bool fresh = st.st_size == 0;
+    if (fresh) {
+      if (capacity < 1 || slot_size < 1) {
+        return fail(fd, EINVAL);
+      }
+      st.st_size = page + (off_t)capacity * slot_stride(slot_size);
+      if (ftruncate(fd, st.st_size) == -1) {
+        return fail(fd, errno);
+      }
+    }
+    if (st.st_size < page) {
+      return fail(fd, EPROTO);
+    }
+    char *base = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+      return fail(fd, errno);
+    }
+    durable_header *hdr = (durable_header *)base;
+    if (fresh) {
+      hdr->capacity = capacity;
+      hdr->slotSize = slot_size;
+      hdr->head = hdr->tail = 0;
+      hdr->magic = durable_header::MAGIC;
+      if (msync(base, page, MS_SYNC) == -1) {
+        int err = errno;
+        munmap(base, st.st_size);
+        return fail(fd, err);
+      }
+    } else if (hdr->magic != durable_header::MAGIC || hdr->capacity < 1 || hdr->slotSize < 1 ||
+               page + (off_t)(hdr->capacity * slot_stride(hdr->slotSize)) > st.st_size ||
+               hdr->tail - hdr->head > (uint64_t)hdr->capacity) {
+      munmap(base, st.st_size);
+      return fail(fd, EPROTO);
+    }
+    return new durable_queue(fd, base, st.st_size, page, batch < 1 ? 1 : batch, window_us);
+  }
+
+  /// Commits what is pending and unmaps the file.
+  ~durable_queue() {
+    close();
+    pthread_join(flusher, NULL);
+    munmap(base, size);
+    ::close(fd);
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&notFull);
+    pthread_cond_destroy(&notEmpty);
+    pthread_cond_destroy(&tick);
+  }
+
+  durable_queue(const durable_queue &) = delete;
+  durable_queue &operator=(const durable_queue &) = delete;
+
+  int capacity() const { return hdr->capacity; }
+  int slot_size() const { return hdr->slotSize; }
+
+  /// Items that were committed but not consumed when the file was opened.
+  long recovered() const { return recoveredItems; }
+
+  /// Group commits so far, and the items they made durable.
+  long commits() const { return commitCount; }
+  long committed_items() const { return committedItems; }
+
+  /// errno of the flush that failed, or 0 while every commit succeeded.
+  int error() const { return syncError; }
+
+  /// Appends len bytes, waiting while every slot is in use. on_slot(slot)
+  /// runs inside the critical section. Returns the slot index, or -1 if the
+  /// queue is closed (or len does not fit a slot, with errno EMSGSIZE, or a
+  /// commit failed, with the msync error).
+  template <typename F>
+  int put(const void *data, int len, F on_slot) {
+    if (len < 0 || len > hdr->slotSize) {
+      errno = EMSGSIZE;
+      return -1;
+    }
+    pthread_mutex_lock(&lock);
+    while (!closed && tail - durableHead == (uint64_t)hdr->capacity) {
+      if (!flushing && (head != durableHead || tail != durableTail)) {
+        // Frees the slots consumers are done with, or publishes the
+        // appends they are waiting for.
+        commit_locked();
+      } else {
+        pthread_cond_wait(&notFull, &lock);
+      }
+    }
+    if (closed) {
+      if (syncError) {
+        errno = syncError;
+      }
+      pthread_mutex_unlock(&lock);
+      return -1;
+    }
+    int slot = tail % hdr->capacity;
+    char *dst = slot_at(slot);
+    memcpy(dst, &len, sizeof(int));
+    memcpy(dst + sizeof(int), data, len);
+    on_slot(slot);
+    tail++;
+    if (!flushing && tail - durableTail >= (uint64_t)batch) {
+      commit_locked();
+    }
+    pthread_mutex_unlock(&lock);
+    return slot;
+  }
+
+  int put(const void *data, int len) { return put(data, len, [](int) {}); }
+
+  /// Copies the oldest committed item into data (at most max bytes), waiting
+  /// while there is none. on_slot(slot) runs inside the critical section.
+  /// Stores the length in *len and returns the slot index, or -1 once the
+  /// queue is closed and drained.
+  template <typename F>
+  int get(void *data, int max, int *len, F on_slot) {
+    pthread_mutex_lock(&lock);
+    while (head == durableTail && !drained) {
+      pthread_cond_wait(&notEmpty, &lock);
+    }
+    if (head == durableTail) {
+      pthread_mutex_unlock(&lock);
+      return -1;
+    }
+    int slot = head % hdr->capacity;
+    const char *src = slot_at(slot);
+    memcpy(len, src, sizeof(int));
+    memcpy(data, src + sizeof(int), *len < max ? *len : max);
+    on_slot(slot);
+    // A full ring only has room again once this read is committed, which a
+    // waiting producer does itself.
+    if (tail - durableHead == (uint64_t)hdr->capacity) {
+      pthread_cond_broadcast(&notFull);
+    }
+    head++;
+    pthread_mutex_unlock(&lock);
+    return slot;
+  }
+
+  int get(void *data, int max, int *len) { return get(data, max, len, [](int) {}); }
+
+  /// Stops accepting items, commits everything pending and lets consumers
+  /// drain. Safe to call more than once.
+  void close() {
+    pthread_mutex_lock(&lock);
+    closed = true;
+    while (flushing) {
+      pthread_cond_wait(&notFull, &lock);
+    }
+    if (!syncError && (tail != durableTail || head != durableHead)) {
+      commit_locked();
+    }
+    drained = true;
+    pthread_cond_broadcast(&notEmpty);
+    pthread_cond_broadcast(&notFull);
+    pthread_cond_signal(&tick);
+    pthread_mutex_unlock(&lock);
+  }
+
+private:
+  durable_queue(int fd, char *base, size_t size, long page, int batch, long window_us)
+      : fd(fd), base(base), size(size), page(page), hdr((durable_header *)base),
+        batch(batch), windowUs(window_us), head(hdr->head), tail(hdr->tail),
+        durableHead(hdr->head), durableTail(hdr->tail), recoveredItems(hdr->tail - hdr->head),
+        commitCount(0), committedItems(0), syncError(0), flushing(false), closed(false),
+        drained(false) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&tick, &cattr);
+    pthread_condattr_destroy(&cattr);
+    pthread_cond_init(&notFull, NULL);
+    pthread_cond_init(&notEmpty, NULL);
+    pthread_create(&flusher, NULL, flush_loop, this);
+  }
+
+  static durable_queue *fail(int fd, int err) {
+    ::close(fd);
+    errno = err;
+    return NULL;
+  }
+
+  static size_t slot_stride(int slot_size) {
+    return (sizeof(int) + slot_size + 7) & ~(size_t)7;
+  }
+
+  char *slot_at(int slot) const {
+    return base + page + (size_t)slot * slot_stride(hdr->slotSize);
+  }
+
+  /// Flushes the pages holding slots [from, to) in sequence order. Returns
+  /// -1 with errno set as soon as one flush fails.
+  int sync_slots(uint64_t from, uint64_t to) {
+    int cap = hdr->capacity;
+    while (from < to) {
+      int first = from % cap;
+      int last = (to - 1) % cap < (uint64_t)first ? cap - 1 : (to - 1) % cap;
+      uintptr_t start = (uintptr_t)slot_at(first) & ~(uintptr_t)(page - 1);
+      uintptr_t end = (uintptr_t)(slot_at(last) + slot_stride(hdr->slotSize));
+      if (msync((void *)start, end - start, MS_SYNC) == -1) {
+        return -1;
+      }
+      from += last - first + 1;
+    }
+    return 0;
+  }
+
+  /// Makes everything appended and consumed so far durable. Called with the
+  /// lock held and no other commit running; drops the lock while flushing
+  /// so producers and consumers keep going. A failed flush closes the
+  /// queue instead of advancing the committed positions.
+  void commit_locked() {
+    flushing = true;
+    uint64_t from = durableTail, to = tail, readFrom = durableHead, readTo = head;
+    pthread_mutex_unlock(&lock);
+
+    // Slots first, then the header that points at them: a crash in between
+    // leaves the old header, which never refers to unflushed slots.
+    int err = 0;
+    if (sync_slots(from, to) == -1) {
+      err = errno;
+    } else {
+      hdr->tail = to;
+      hdr->head = readTo;
+      if (msync(base, page, MS_SYNC) == -1) {
+        err = errno;
+        hdr->tail = from;
+        hdr->head = readFrom;
+      }
+    }
+
+    pthread_mutex_lock(&lock);
+    flushing = false;
+    if (err) {
+      syncError = err;
+      closed = drained = true;
+      pthread_cond_broadcast(&notEmpty);
+      pthread_cond_broadcast(&notFull);
+      pthread_cond_signal(&tick);
+      return;
+    }
+    durableTail = to;
+    durableHead = readTo;
+    commitCount++;
+    committedItems += to - from;
+    pthread_cond_broadcast(&notEmpty);
+    pthread_cond_broadcast(&notFull);
+  }
+
+  /// Commits whatever has been pending for a whole window.
+  static void *flush_loop(void *arg) {
+    durable_queue *q = (durable_queue *)arg;
+    pthread_mutex_lock(&q->lock);
+    while (!q->closed) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      deadline.tv_sec += q->windowUs / 1000000;
+      deadline.tv_nsec += (q->windowUs % 1000000) * 1000;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&q->tick, &q->lock, &deadline);
+      if (!q->closed && !q->flushing && (q->tail != q->durableTail || q->head != q->durableHead)) {
+        q->commit_locked();
+      }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+  }
+
+  int fd;
+  char *base;
+  size_t size;
+  long page;
+  durable_header *hdr;
+  int batch;
+  long windowUs;
+  uint64_t head, tail;               ///< Live positions.
+  uint64_t durableHead, durableTail; ///< Positions as of the last commit.
+  long recoveredItems;
+  long commitCount, committedItems;
+  int syncError;
+  bool flushing, closed, drained;
+  pthread_t flusher;
+  pthread_mutex_t lock;
+  pthread_cond_t notFull, notEmpty, tick;
+};
+
+#endif // DURABLE_QUEUE_HPP
@@ -0,0 +1,358 @@
+#ifndef ELASTIC_BUFFER_HPP
+#define ELASTIC_BUFFER_HPP
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "trace.hpp"
+#include "wait_sem.hpp"
+
+/// One point of an elastic_buffer's capacity timeline.
+struct capacity_change {
+  uint64_t at; ///< Nanoseconds since the buffer was created.
+  int capacity;
+};
+
+/// Bounded buffer whose capacity moves between powers of two while it runs.
+///
+/// A background tuner looks at each interval's totals: how long producers
+/// sat blocked on a full buffer, how long consumers sat idle on an empty
+/// one, and the most items held at once. When both sides waited, the buffer
+/// is swinging between full and empty and it doubles. When no producer
+/// blocked and it never got past a quarter full, it halves.
+///
+/// Resizing never copies or stops anything. The items live in a chain of
+/// ring segments: a resize links a new segment sized for the new capacity,
+/// producers fill the newest segment, consumers drain the oldest and free
+/// it once it is empty and no longer the newest. The capacity itself is
+/// just the number of `empty` permits: growing posts the extra permits, and
+/// shrinking takes back what it can at once and collects the rest as
+/// consumers free slots. A producer that still finds the newest segment full
+/// (a reservation made before a shrink) links another one.
+///
+/// End of stream works as in bounded_buffer: once `limit` items have gone
+/// in, puts fail and gets drain what is left and then return 0.
+template <typename T>
+class elastic_buffer {
+public:
+  /// Capacities are rounded up to powers of two; the tuner keeps the
+  /// capacity within [min_capacity, max_capacity] and looks every
+  /// interval_us microseconds.
+  elastic_buffer(int capacity, int min_capacity, int max_capacity, long interval_us, int limit = -1,
+                 wait_policy policy = wait_policy::block)
+      : minCap(ceil_pow2(min_capacity)), maxCap(ceil_pow2(max_capacity)), cap(ceil_pow2(capacity)),
+        count(0), peak(0), moved(0), debt(0), nextBase(0), limit(limit), produced(0), published(0),
+        closed(false), intervalUs(interval_us), blockedNs(0), idleNs(0), stopping(false),
+        empty(ceil_pow2(capacity), policy), full(0, policy) {
+    sem_init(&mutex, 0, 1);
+    head = tail = new_segment(cap);
+    born = trace_now();
+    capacity_change first = {0, cap};
+    changes.push_back(first);
+    pthread_mutex_init(&tunerLock, NULL);
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&tick, &cattr);
+    pthread_condattr_destroy(&cattr);
+    pthread_create(&tuner, NULL, tune_loop, this);
+    if (limit == 0) {
+      close();
+    }
+  }
+
+  ~elastic_buffer() {
+    stop_tuner();
+    pthread_join(tuner, NULL);
+    while (head) {
+      segment *next = head->next;
+      delete head;
+      head = next;
+    }
+    sem_destroy(&mutex);
+    pthread_mutex_destroy(&tunerLock);
+    pthread_cond_destroy(&tick);
+  }
+
+  elastic_buffer(const elastic_buffer &) = delete;
+  elastic_buffer &operator=(const elastic_buffer &) = delete;
+
+  /// Current capacity.
+  int capacity() const { return cap.load(std::memory_order_relaxed); }
+
+  /// Every capacity the buffer has had, oldest first. Only stable once the
+  /// buffer is closed.
+  const std::vector<capacity_change> &history() const { return changes; }
+
+  /// Moves up to n items in; see bounded_buffer::put_n(). Slot numbers are
+  /// unique among the items held at any one time.
+  template <typename F>
+  int put_n(T *items, int n, F on_slot) {
+    int reserved = empty.try_wait_up_to(n);
+    if (!reserved) {
+      uint64_t start = trace_now();
+      reserved = empty.wait_up_to(n);
+      blockedNs.fetch_add(trace_now() - start, std::memory_order_relaxed);
+      if (!reserved) {
+        return 0;
+      }
+    }
+    sem_wait(&mutex);
+
+    int count = closed ? 0 : limit < 0 || limit - produced >= reserved ? reserved : limit - produced;
+    for (int i = 0; i < count; i++) {
+      if (tail->count == tail->cap) {
+        tail = tail->next = new_segment(cap.load(std::memory_order_relaxed));
+      }
+      int idx = (tail->head + tail->count) & (tail->cap - 1);
+      tail->slots[idx] = std::move(items[i]);
+      on_slot(tail->slots[idx], tail->base + idx);
+      tail->count++;
+    }
+    this->count += count;
+    peak = this->count > peak ? this->count : peak;
+    produced += count;
+    bool last = limit >= 0 && !closed && produced == limit;
+    if (last) {
+      closed = true;
+    }
+
+    sem_post(&mutex);
+
+    empty.post(reserved - count);
+    if (last) {
+      empty.close();
+    }
+    full.post(count);
+    if (limit >= 0 && count > 0 && published.fetch_add(count) + count == limit) {
+      full.close();
+      stop_tuner();
+    }
+    return count;
+  }
+
+  /// Moves up to n items out; see bounded_buffer::get_n().
+  template <typename F>
+  int get_n(T *items, int n, F on_slot) {
+    int count = full.try_wait_up_to(n);
+    if (!count) {
+      uint64_t start = trace_now();
+      count = full.wait_up_to(n);
+      idleNs.fetch_add(trace_now() - start, std::memory_order_relaxed);
+      if (!count) {
+        return 0;
+      }
+    }
+    sem_wait(&mutex);
+
+    for (int i = 0; i < count; i++) {
+      // We hold a permit per item, so a segment with items follows any
+      // drained (or never used) ones at the head.
+      while (head->count == 0) {
+        segment *done = head;
+        head = head->next;
+        delete done;
+      }
+      int idx = head->head;
+      items[i] = std::move(head->slots[idx]);
+      head->slots[idx] = T();
+      on_slot(items[i], head->base + idx);
+      head->head = (idx + 1) & (head->cap - 1);
+      head->count--;
+    }
+    while (head->count == 0 && head != tail) {
+      segment *done = head;
+      head = head->next;
+      delete done;
+    }
+    this->count -= count;
+    moved += count;
+    // Slots owed to a shrink are kept instead of handed back.
+    int owed = debt < count ? debt : count;
+    debt -= owed;
+
+    sem_post(&mutex);
+
+    empty.post(count - owed);
+    return count;
+  }
+
+  /// Ends the stream; see bounded_buffer::close().
+  void close() {
+    sem_wait(&mutex);
+    closed = true;
+    sem_post(&mutex);
+    empty.close();
+    full.close();
+    stop_tuner();
+  }
+
+private:
+  enum { PROBE_INTERVALS = 100 }; ///< How long a failed doubling is not retried.
+
+  struct segment {
+    segment(int capacity, int base)
+        : slots(new T[capacity]), cap(capacity), head(0), count(0), base(base), next(NULL) {}
+    ~segment() { delete[] slots; }
+
+    T *slots;
+    int cap;   ///< A power of two.
+    int head;  ///< Index of the oldest item.
+    int count; ///< Items held.
+    int base;  ///< Added to indices to make the slot numbers callers see.
+    segment *next;
+  };
+
+  /// Numbers the new segment's slots after every earlier segment's.
+  segment *new_segment(int capacity) {
+    segment *s = new segment(capacity, nextBase);
+    nextBase += capacity;
+    return s;
+  }
+
+  /// Smallest power of two at least n, saturating at 2^30 so it never
+  /// overflows an int.
+  static int ceil_pow2(int n) {
+    int p = 1;
+    while (p < n && p < (1 << 30)) {
+      p <<= 1;
+    }
+    return p;
+  }
+
+  /// Ends the tuner's loop: the stream is over or the buffer is going away.
+  void stop_tuner() {
+    pthread_mutex_lock(&tunerLock);
+    stopping = true;
+    pthread_cond_signal(&tick);
+    pthread_mutex_unlock(&tunerLock);
+  }
+
+  static void *tune_loop(void *arg) {
+    ((elastic_buffer *)arg)->tune();
+    return NULL;
+  }
+
+  /// Once per interval: doubles the capacity when both producers and
+  /// consumers waited, halves it when producers never waited and the
+  /// buffer stayed at most a quarter full.
+  ///
+  /// Doubling is a trial. If the next interval's waiting per item moved is
+  /// not at least a tenth lower, more room does not help (the waits come from scheduling,
+  /// not from bursts), so the capacity drops back and stays below that size
+  /// for PROBE_INTERVALS before trying again.
+  void tune() {
+    bool trial = false;
+    double waitedBefore = 0;
+    int ceiling = maxCap, hold = 0;
+    pthread_mutex_lock(&tunerLock);
+    while (!stopping) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      deadline.tv_sec += intervalUs / 1000000;
+      deadline.tv_nsec += (intervalUs % 1000000) * 1000;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&tick, &tunerLock, &deadline);
+      if (stopping) {
+        break;
+      }
+
+      uint64_t threshold = intervalUs * 1000 / 100; // 1% of the interval
+      uint64_t blocked = blockedNs.exchange(0, std::memory_order_relaxed);
+      uint64_t idle = idleNs.exchange(0, std::memory_order_relaxed);
+      sem_wait(&mutex);
+      int high = peak;
+      peak = count;
+      long items = moved;
+      moved = 0;
+      sem_post(&mutex);
+
+      int now = cap.load(std::memory_order_relaxed);
+      double waited = (double)(blocked + idle) / (items ? items : 1);
+      if (trial) {
+        trial = false;
+        if (waited > waitedBefore * 0.9) {
+          ceiling = now / 2;
+          hold = PROBE_INTERVALS;
+          resize(now / 2);
+          continue;
+        }
+      }
+      if (hold > 0 && --hold == 0) {
+        ceiling = maxCap;
+      }
+      if (blocked > threshold && idle > threshold && now < ceiling) {
+        trial = true;
+        waitedBefore = waited;
+        resize(now * 2);
+      } else if (blocked == 0 && high <= now / 4 && now > minCap) {
+        resize(now / 2);
+      }
+    }
+    pthread_mutex_unlock(&tunerLock);
+  }
+
+  /// Moves the capacity to `to`; called by the tuner only.
+  void resize(int to) {
+    int from = cap.load(std::memory_order_relaxed);
+    // Free slots taken back straight away; the rest is owed by consumers.
+    int reclaimed = to < from ? empty.try_wait_up_to(from - to) : 0;
+    sem_wait(&mutex);
+    cap.store(to, std::memory_order_relaxed);
+    if (to < from) {
+      debt += from - to - reclaimed;
+    } else {
+      // Growing pays off any debt left from an earlier shrink first.
+      int owed = debt < to - from ? debt : to - from;
+      debt -= owed;
+      reclaimed = owed;
+    }
+    if (tail->count == 0 && head == tail) {
+      // Nothing held: swap the storage outright.
+      delete tail;
+      head = tail = new_segment(to);
+    } else {
+      tail = tail->next = new_segment(to);
+    }
+    sem_post(&mutex);
+    if (to > from) {
+      empty.post(to - from - reclaimed);
+    }
+    capacity_change change = {trace_now() - born, to};
+    changes.push_back(change);
+  }
+
+  segment *head, *tail; ///< Oldest and newest segments.
+  int minCap, maxCap;
+  std::atomic<int> cap;
+  int count, peak; ///< Items held now and at most since the tuner last looked.
+  long moved;      ///< Items taken out since the tuner last looked.
+  int debt;        ///< Slots a shrink still has to collect from consumers.
+  int nextBase;    ///< First slot number of the next segment.
+  int limit, produced;
+  std::atomic<int> published;
+  bool closed;
+  sem_t mutex;
+
+  long intervalUs;
+  std::atomic<uint64_t> blockedNs, idleNs; ///< Waiting since the tuner last looked.
+  uint64_t born;
+  std::vector<capacity_change> changes;
+  bool stopping;
+  pthread_t tuner;
+  pthread_mutex_t tunerLock;
+  pthread_cond_t tick;
+
+  wait_sem empty, full;
+};
+
+#endif // ELASTIC_BUFFER_HPP
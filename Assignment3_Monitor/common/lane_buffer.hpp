@@ -0,0 +1,258 @@
+#ifndef LANE_BUFFER_HPP
+#define LANE_BUFFER_HPP
+
+#include <semaphore.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <utility>
+
+#include "bounded_buffer.hpp"
+#include "trace.hpp"
+
+/// How consumers pick the lane to serve next.
+enum class lane_order {
+  strict, ///< Always the highest-priority (lowest-numbered) non-empty lane.
+  fair    ///< Weighted round robin: lane i gets weight[i] turns per round.
+};
+
+/// Parses "strict" or "fair". Returns false on anything else.
+inline bool parse_lane_order(const char *name, lane_order *order) {
+  if (!strcmp(name, "strict")) {
+    *order = lane_order::strict;
+  } else if (!strcmp(name, "fair")) {
+    *order = lane_order::fair;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/// Queueing delay seen in one lane.
+struct lane_stats {
+  long items;
+  uint64_t mean, p99, max; ///< Nanoseconds; p99 is a power-of-two upper bound.
+};
+
+/// Bounded buffer with up to 32 priority lanes, lane 0 being the most
+/// urgent. Each lane is its own ring with its own capacity, so bulk traffic
+/// filling one lane never blocks producers of another.
+///
+/// A bitmap of non-empty lanes makes picking the next lane O(1) under
+/// either lane_order: a count-trailing-zeros for strict priority, and a
+/// rotate-and-count for the round robin. Every item is stamped on the way in
+/// so each lane keeps a log2 histogram of its queueing delay.
+///
+/// End of stream works as in bounded_buffer: once `limit` items have gone
+/// in, puts fail and gets drain the lanes and then return 0.
+template <typename T>
+class lane_buffer {
+public:
+  enum { MAX_LANES = 32, BUCKETS = 64 };
+
+  /// weights[i] is lane i's share under lane_order::fair (at least 1); it
+  /// may be NULL for strict order.
+  lane_buffer(int lanes, int lane_capacity, lane_order order, const int *weights,
+              int limit = -1, wait_policy policy = wait_policy::block)
+      : numLanes(lanes), cap(lane_capacity), order(order), nonEmpty(0),
+        current(lanes - 1), credit(0), limit(limit), produced(0), published(0),
+        closed(false), full(0, policy) {
+    sem_init(&mutex, 0, 1);
+    lane = new lane_state *[lanes];
+    for (int i = 0; i < lanes; i++) {
+      lane[i] = new lane_state(lane_capacity, weights ? weights[i] : 1, policy);
+    }
+    if (limit == 0) {
+      close_all();
+    }
+  }
+
+  ~lane_buffer() {
+    for (int i = 0; i < numLanes; i++) {
+      delete lane[i];
+    }
+    delete[] lane;
+    sem_destroy(&mutex);
+  }
+
+  lane_buffer(const lane_buffer &) = delete;
+  lane_buffer &operator=(const lane_buffer &) = delete;
+
+  int lanes() const { return numLanes; }
+  int lane_capacity() const { return cap; }
+
+  /// Moves up to n items into lane `l`, waiting while that lane is full.
+  /// on_slot(item, slot) runs inside the critical section; slot numbers run
+  /// lane by lane (lane * lane_capacity() + index). Returns the number
+  /// taken, which is at least 1 unless the buffer is closed.
+  template <typename F>
+  int put_n(T *items, int n, int l, F on_slot) {
+    lane_state *dst = lane[l];
+    int reserved = dst->space.wait_up_to(n);
+    if (reserved == 0) {
+      return 0;
+    }
+    uint64_t now = trace_now();
+    sem_wait(&mutex);
+
+    int count = closed ? 0 : limit < 0 || limit - produced >= reserved ? reserved : limit - produced;
+    for (int i = 0; i < count; i++) {
+      int idx = dst->in;
+      dst->slots[idx] = std::move(items[i]);
+      dst->stamps[idx] = now;
+      on_slot(dst->slots[idx], l * cap + idx);
+      dst->in = (idx + 1) % cap;
+    }
+    dst->count += count;
+    if (count > 0) {
+      nonEmpty |= 1u << l;
+    }
+    produced += count;
+    bool last = limit >= 0 && !closed && produced == limit;
+    if (last) {
+      closed = true;
+    }
+
+    sem_post(&mutex);
+
+    dst->space.post(reserved - count);
+    if (last) {
+      for (int i = 0; i < numLanes; i++) {
+        lane[i]->space.close();
+      }
+    }
+    full.post(count);
+    if (limit >= 0 && count > 0 && published.fetch_add(count) + count == limit) {
+      full.close();
+    }
+    return count;
+  }
+
+  /// Moves up to n items out, choosing the lane afresh for each one.
+  /// on_slot(item, slot) runs inside the critical section. Returns the
+  /// number taken, which is at least 1 unless the buffer is closed and
+  /// drained.
+  template <typename F>
+  int get_n(T *items, int n, F on_slot) {
+    int count = full.wait_up_to(n);
+    if (count == 0) {
+      return 0;
+    }
+    int freed[MAX_LANES];
+    uint32_t touched = 0;
+    sem_wait(&mutex);
+    // Read the clock under the lock: a producer that stamped an item after
+    // an earlier reading could have put it in before we got here.
+    uint64_t now = trace_now();
+
+    for (int i = 0; i < count; i++) {
+      int l = pick();
+      lane_state *src = lane[l];
+      int idx = src->out;
+      items[i] = std::move(src->slots[idx]);
+      src->slots[idx] = T();
+      on_slot(items[i], l * cap + idx);
+      src->out = (idx + 1) % cap;
+      if (--src->count == 0) {
+        nonEmpty &= ~(1u << l);
+      }
+      src->record(now - src->stamps[idx]);
+      if (!(touched & (1u << l))) {
+        touched |= 1u << l;
+        freed[l] = 0;
+      }
+      freed[l]++;
+    }
+
+    sem_post(&mutex);
+
+    for (; touched; touched &= touched - 1) {
+      int l = __builtin_ctz(touched);
+      lane[l]->space.post(freed[l]);
+    }
+    return count;
+  }
+
+  /// Delay statistics of lane `l`; only exact once the threads have stopped.
+  lane_stats stats(int l) const {
+    const lane_state *s = lane[l];
+    lane_stats out = {s->items, s->items ? s->delaySum / s->items : 0, 0, s->delayMax};
+    long seen = 0;
+    for (int b = 0; b < BUCKETS && s->items; b++) {
+      seen += s->hist[b];
+      if (seen * 100 >= s->items * 99) {
+        out.p99 = b >= 63 ? UINT64_MAX : (2ull << b) - 1;
+        break;
+      }
+    }
+    return out;
+  }
+
+private:
+  struct lane_state {
+    lane_state(int capacity, int weight, wait_policy policy)
+        : slots(new T[capacity]), stamps(new uint64_t[capacity]), in(0), out(0),
+          count(0), weight(weight < 1 ? 1 : weight), items(0), delaySum(0),
+          delayMax(0), space(capacity, policy) {
+      memset(hist, 0, sizeof(hist));
+    }
+    ~lane_state() {
+      delete[] slots;
+      delete[] stamps;
+    }
+
+    void record(uint64_t delay) {
+      items++;
+      delaySum += delay;
+      delayMax = delay > delayMax ? delay : delayMax;
+      hist[delay ? 63 - __builtin_clzll(delay) : 0]++;
+    }
+
+    T *slots;
+    uint64_t *stamps; ///< trace_now() when each slot was filled.
+    int in, out, count, weight;
+    long items;
+    uint64_t delaySum, delayMax;
+    long hist[BUCKETS]; ///< hist[b] counts delays in [2^b, 2^(b+1)).
+    wait_sem space;
+  };
+
+  /// Next lane to serve; the caller holds the mutex and at least one lane
+  /// is non-empty.
+  int pick() {
+    if (order == lane_order::strict) {
+      return __builtin_ctz(nonEmpty);
+    }
+    if (credit > 0 && (nonEmpty & (1u << current))) {
+      credit--;
+      return current;
+    }
+    // First non-empty lane after the current one, wrapping around.
+    uint32_t after = nonEmpty & ~(uint32_t)((2ull << current) - 1);
+    current = __builtin_ctz(after ? after : nonEmpty);
+    credit = lane[current]->weight - 1;
+    return current;
+  }
+
+  void close_all() {
+    closed = true;
+    for (int i = 0; i < numLanes; i++) {
+      lane[i]->space.close();
+    }
+    full.close();
+  }
+
+  int numLanes, cap;
+  lane_state **lane;
+  lane_order order;
+  uint32_t nonEmpty; ///< Bit l set while lane l holds items.
+  int current, credit;
+  int limit, produced;
+  std::atomic<int> published;
+  bool closed;
+  sem_t mutex;
+  wait_sem full;
+};
+
+#endif // LANE_BUFFER_HPP
@@ -0,0 +1,154 @@
+#ifndef MULTICAST_RING_HPP
+#define MULTICAST_RING_HPP
+
+#include <sched.h>
+
+#include <atomic>
+#include <utility>
+
+#include "wait_sem.hpp"
+
+/// Broadcast ring in the style of the LMAX disruptor: every consumer sees
+/// every item.
+///
+/// Producers claim a range of the single write sequence, move their items
+/// into those slots and publish by advancing `cursor` in claim order.
+/// Each consumer keeps its own read sequence and reads everything up to
+/// `cursor` in place, so an item is stored once no matter how many consumers
+/// see it. A producer may only reuse a slot once the slowest consumer has
+/// moved past it. No locks are taken anywhere: waiting (for space, for the
+/// previous claim to publish, for new items) spins with a pause hint and
+/// then yields the CPU.
+///
+/// Like bounded_buffer it optionally carries a fixed number of items in
+/// total; without a limit the stream ends with close().
+template <typename T>
+class multicast_ring {
+public:
+  multicast_ring(int capacity, int consumers, long limit = -1)
+      : slots(new T[capacity]), cap(capacity), numReaders(consumers),
+        readers(new reader[consumers]), limit(limit), claimed(0), cursor(0),
+        gate(0), closed(false) {
+    for (int i = 0; i < consumers; i++) {
+      readers[i].seq.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  ~multicast_ring() {
+    delete[] slots;
+    delete[] readers;
+  }
+
+  multicast_ring(const multicast_ring &) = delete;
+  multicast_ring &operator=(const multicast_ring &) = delete;
+
+  int capacity() const { return cap; }
+  int consumers() const { return numReaders; }
+
+  /// Moves up to n items from the front of `items` in and publishes them.
+  /// on_slot(item, slot) runs for each item before it is published. Returns
+  /// the number taken, which is at least 1 unless the limit has been reached
+  /// or the ring is closed.
+  template <typename F>
+  int put_n(T *items, int n, F on_slot) {
+    n = n < cap ? n : cap;
+    long start = claimed.load(std::memory_order_relaxed);
+    long count;
+    do {
+      if (closed.load(std::memory_order_relaxed)) {
+        return 0;
+      }
+      count = limit < 0 || limit - start >= n ? n : limit - start;
+      if (count <= 0) {
+        return 0;
+      }
+    } while (!claimed.compare_exchange_weak(start, start + count, std::memory_order_relaxed));
+
+    // Wait for the slowest consumer to leave the slots we are about to reuse.
+    long end = start + count;
+    for (unsigned i = 0; end - gate.load(std::memory_order_acquire) > cap; i++) {
+      long slowest = min_read();
+      if (end - slowest <= cap) {
+        gate.store(slowest, std::memory_order_release);
+        break;
+      }
+      backoff(i);
+    }
+
+    for (long s = start; s < end; s++) {
+      int slot = s % cap;
+      slots[slot] = std::move(items[s - start]);
+      on_slot(slots[slot], slot);
+    }
+
+    // Publish in claim order so consumers never see a gap.
+    for (unsigned i = 0; cursor.load(std::memory_order_acquire) != start; i++) {
+      backoff(i);
+    }
+    cursor.store(end, std::memory_order_release);
+    return count;
+  }
+
+  /// Reads up to max published items for consumer `self` in place, calling
+  /// on_item(item, slot) for each, then releases their slots. Returns the
+  /// number read, which is at least 1 unless the stream has ended and
+  /// `self` has seen all of it.
+  template <typename F>
+  int get_n(int self, int max, F on_item) {
+    std::atomic<long> &seq = readers[self].seq;
+    long s = seq.load(std::memory_order_relaxed);
+    long avail;
+    for (unsigned i = 0; (avail = cursor.load(std::memory_order_acquire)) == s; i++) {
+      if (s == limit || (closed.load(std::memory_order_acquire) && cursor.load(std::memory_order_acquire) == s)) {
+        return 0;
+      }
+      backoff(i);
+    }
+    long count = avail - s < max ? avail - s : max;
+    for (long k = s; k < s + count; k++) {
+      on_item((const T &)slots[k % cap], (int)(k % cap));
+    }
+    seq.store(s + count, std::memory_order_release);
+    return count;
+  }
+
+  /// Ends the stream once the producers are done; consumers finish what has
+  /// been published.
+  void close() { closed.store(true, std::memory_order_release); }
+
+private:
+  struct reader {
+    std::atomic<long> seq; ///< Next sequence this consumer reads.
+    char pad[56];          ///< One cache line per consumer.
+  };
+
+  long min_read() const {
+    long slowest = readers[0].seq.load(std::memory_order_acquire);
+    for (int i = 1; i < numReaders; i++) {
+      long seq = readers[i].seq.load(std::memory_order_acquire);
+      slowest = seq < slowest ? seq : slowest;
+    }
+    return slowest;
+  }
+
+  static void backoff(unsigned i) {
+    if (i < 64) {
+      cpu_relax();
+    } else {
+      sched_yield();
+    }
+  }
+
+  T *slots;
+  int cap, numReaders;
+  reader *readers;
+  long limit;
+  std::atomic<long> claimed; ///< Next sequence a producer may claim.
+  char pad1[64];
+  std::atomic<long> cursor;  ///< Everything below has been published.
+  char pad2[64];
+  std::atomic<long> gate;    ///< Cached slowest read sequence.
+  std::atomic<bool> closed;
+};
+
+#endif // MULTICAST_RING_HPP
@@ -0,0 +1,121 @@
+#ifndef PAYLOAD_POOL_HPP
+#define PAYLOAD_POOL_HPP
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <vector>
+
+class payload_pool;
+
+/// Move-only handle to one block of a payload_pool. Only this handle travels
+/// through a queue; the block itself is never copied. Destroying or resetting
+/// the handle recycles the block back to its pool.
+class payload {
+public:
+  payload() : pool(NULL), data(NULL) {}
+  payload(payload_pool *pool, char *data) : pool(pool), data(data) {}
+  payload(payload &&other) : pool(other.pool), data(other.data) {
+    other.pool = NULL;
+    other.data = NULL;
+  }
+  payload &operator=(payload &&other) {
+    if (this != &other) {
+      reset();
+      pool = other.pool;
+      data = other.data;
+      other.pool = NULL;
+      other.data = NULL;
+    }
+    return *this;
+  }
+  ~payload() { reset(); }
+
+  payload(const payload &) = delete;
+  payload &operator=(const payload &) = delete;
+
+  char *get() const { return data; }
+  size_t size() const;
+
+  /// Returns the block to its pool; the handle becomes empty.
+  inline void reset();
+
+private:
+  payload_pool *pool;
+  char *data;
+};
+
+/// Fixed-size blocks carved out of one slab at startup. Free blocks sit on a
+/// LIFO stack so the most recently recycled (cache-warm) block is handed out
+/// next, and acquire() blocks while every block is in flight. After
+/// construction no malloc/free happens.
+class payload_pool {
+public:
+  payload_pool(size_t block_size, int blocks) : blockSize(block_size) {
+    // Page-align each block so large payloads don't share cache lines or pages.
+    stride = (block_size + 4095) & ~(size_t)4095;
+    if (posix_memalign((void **)&slab, 4096, stride * blocks) != 0) {
+      slab = NULL;
+      blocks = 0;
+    }
+    freeList.reserve(blocks);
+    for (int i = blocks - 1; i >= 0; i--) {
+      freeList.push_back(slab + stride * i);
+    }
+    pthread_mutex_init(&lock, NULL);
+    sem_init(&available, 0, blocks);
+  }
+
+  ~payload_pool() {
+    free(slab);
+    pthread_mutex_destroy(&lock);
+    sem_destroy(&available);
+  }
+
+  payload_pool(const payload_pool &) = delete;
+  payload_pool &operator=(const payload_pool &) = delete;
+
+  bool ok() const { return slab != NULL; }
+  size_t block_size() const { return blockSize; }
+
+  /// Takes a free block, waiting for a consumer to recycle one if needed.
+  payload acquire() {
+    sem_wait(&available);
+    pthread_mutex_lock(&lock);
+    char *block = freeList.back();
+    freeList.pop_back();
+    pthread_mutex_unlock(&lock);
+    return payload(this, block);
+  }
+
+  /// Puts a block back on the free list. Called by payload::reset().
+  void release(char *block) {
+    pthread_mutex_lock(&lock);
+    freeList.push_back(block);
+    pthread_mutex_unlock(&lock);
+    sem_post(&available);
+  }
+
+private:
+  size_t blockSize, stride;
+  char *slab;
+  std::vector<char *> freeList;
+  pthread_mutex_t lock;
+  sem_t available;
+};
+
+inline size_t payload::size() const {
+  return pool ? pool->block_size() : 0;
+}
+
+inline void payload::reset() {
+  if (pool) {
+    pool->release(data);
+  }
+  pool = NULL;
+  data = NULL;
+}
+
+#endif // PAYLOAD_POOL_HPP
@@ -0,0 +1,207 @@
+#ifndef SHARDED_BUFFER_HPP
+#define SHARDED_BUFFER_HPP
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include <atomic>
+#include <vector>
+
+#include "wait_sem.hpp"
+#include "ws_deque.hpp"
+
+/// Bounded buffer split into one shard per consumer, so consumers stop
+/// contending on a single lock.
+///
+/// Producers append to a shard's inbox (a short critical section on that
+/// shard only). The owning consumer moves its whole inbox into its own
+/// work-stealing deque in one step and then pops lock-free. A consumer whose
+/// shard is dry steals from the top of the other deques, and failing that
+/// from the other inboxes.
+///
+/// Two counting semaphores keep it bounded and exact: `space` holds a permit
+/// per free slot across all shards and `ready` a permit per item anywhere in
+/// the buffer, so a consumer that got a `ready` permit is guaranteed to find
+/// an item. Every shard is sized for the whole capacity, so a producer that
+/// got a `space` permit never finds its shard full.
+///
+/// An item can briefly be invisible to everyone but its shard's owner, while
+/// the owner moves its inbox into its deque. A consumer that holds a permit
+/// but finds nothing spins for SPINS rounds, then falls back to the wait
+/// policy: it yields under wait_policy::spin and otherwise parks until the
+/// next refill (or PARK_NS at most, in case it only lost a steal race).
+///
+/// Like bounded_buffer it optionally accepts a fixed number of items in
+/// total: put() and get() hand out tickets up front, so exactly `limit`
+/// calls of each succeed and the rest return false without waiting.
+template <typename T>
+class sharded_buffer {
+public:
+  enum {
+    SPINS = 64,       ///< Pause rounds before a stalled get yields or parks.
+    PARK_NS = 1000000 ///< Longest a stalled get parks before looking again.
+  };
+
+  sharded_buffer(int capacity, int shards, int limit = -1, wait_policy policy = wait_policy::block)
+      : cap(capacity), count(shards), limit(limit), produced(0), consumed(0),
+        space(capacity, policy), ready(0, policy), refills(0), stalled(0), policy(policy) {
+    shard = new shard_state *[shards];
+    for (int i = 0; i < shards; i++) {
+      shard[i] = new shard_state(capacity);
+    }
+  }
+
+  ~sharded_buffer() {
+    for (int i = 0; i < count; i++) {
+      delete shard[i];
+    }
+    delete[] shard;
+  }
+
+  sharded_buffer(const sharded_buffer &) = delete;
+  sharded_buffer &operator=(const sharded_buffer &) = delete;
+
+  int capacity() const { return cap; }
+  int shards() const { return count; }
+
+  /// Appends item to shard key % shards(). on_shard(item, shard) runs inside
+  /// the shard's critical section. Returns false once the limit is reached.
+  template <typename F>
+  bool put(const T &item, unsigned key, F on_shard) {
+    if (limit >= 0 && produced.fetch_add(1, std::memory_order_relaxed) >= limit) {
+      return false;
+    }
+    space.wait();
+    int s = key % count;
+    shard_state *dst = shard[s];
+    pthread_mutex_lock(&dst->lock);
+    dst->inbox.push_back(item);
+    on_shard(item, s);
+    pthread_mutex_unlock(&dst->lock);
+    ready.post();
+    return true;
+  }
+
+  /// Takes an item for consumer `self`, from its own shard if it has one and
+  /// stolen otherwise. on_shard(item, shard) runs once the item is taken.
+  /// Returns false once every item up to the limit has been handed out.
+  template <typename F>
+  bool get(T &item, int self, F on_shard) {
+    if (limit >= 0 && consumed.fetch_add(1, std::memory_order_relaxed) >= limit) {
+      return false;
+    }
+    ready.wait();
+    shard_state *own = shard[self];
+    int from = self;
+    int seen = refills.load(std::memory_order_seq_cst);
+    for (unsigned spins = 1; !own->work.pop(item) && !(refill(own) && own->work.pop(item)); spins++) {
+      if ((from = steal(item, self)) >= 0) {
+        own->steals++;
+        break;
+      }
+      // The item we hold a permit for is between an inbox and a deque.
+      stall(seen, spins);
+      seen = refills.load(std::memory_order_seq_cst);
+    }
+    own->taken++;
+    space.post();
+    on_shard(item, from < 0 ? self : from);
+    return true;
+  }
+
+  /// Items consumer `self` has taken so far, and how many of them it stole.
+  /// Only exact once the consumers have stopped.
+  long taken(int self) const { return shard[self]->taken; }
+  long steals(int self) const { return shard[self]->steals; }
+
+private:
+  struct shard_state {
+    explicit shard_state(int capacity) : work(capacity), taken(0), steals(0) {
+      pthread_mutex_init(&lock, NULL);
+      inbox.reserve(capacity);
+      spare.reserve(capacity);
+    }
+    ~shard_state() { pthread_mutex_destroy(&lock); }
+
+    pthread_mutex_t lock;   ///< Guards inbox.
+    std::vector<T> inbox;   ///< Filled by producers.
+    std::vector<T> spare;   ///< Owner-only; swapped with inbox on refill.
+    ws_deque<T> work;       ///< Owner pops, everyone else steals.
+    long taken, steals;     ///< Owner-only counters.
+    char pad[64];
+  };
+
+  /// Moves the owner's whole inbox into its deque. Returns whether anything
+  /// moved.
+  bool refill(shard_state *own) {
+    pthread_mutex_lock(&own->lock);
+    own->inbox.swap(own->spare);
+    pthread_mutex_unlock(&own->lock);
+    for (size_t i = 0; i < own->spare.size(); i++) {
+      own->work.push(own->spare[i]);
+    }
+    bool moved = !own->spare.empty();
+    own->spare.clear();
+    if (moved) {
+      refills.fetch_add(1, std::memory_order_seq_cst);
+      if (stalled.load(std::memory_order_seq_cst) > 0) {
+        futex_wake(&refills, INT_MAX);
+      }
+    }
+    return moved;
+  }
+
+  /// Backs off after the spins-th fruitless look for an item; seen is the
+  /// refill count read before that look.
+  void stall(int seen, unsigned spins) {
+    if (spins < SPINS) {
+      cpu_relax();
+    } else if (policy == wait_policy::spin || spins < SPINS + wait_sem::YIELDS) {
+      sched_yield();
+    } else {
+      struct timespec timeout = {0, PARK_NS};
+      stalled.fetch_add(1, std::memory_order_seq_cst);
+      futex_wait(&refills, seen, &timeout);
+      stalled.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  /// Steals one item from another shard, deques first. Returns the shard it
+  /// came from, or -1.
+  int steal(T &item, int self) {
+    for (int i = 1; i < count; i++) {
+      int victim = (self + i) % count;
+      if (shard[victim]->work.steal(item)) {
+        return victim;
+      }
+    }
+    for (int i = 1; i < count; i++) {
+      int victim = (self + i) % count;
+      shard_state *src = shard[victim];
+      pthread_mutex_lock(&src->lock);
+      bool got = !src->inbox.empty();
+      if (got) {
+        item = src->inbox.back();
+        src->inbox.pop_back();
+      }
+      pthread_mutex_unlock(&src->lock);
+      if (got) {
+        return victim;
+      }
+    }
+    return -1;
+  }
+
+  int cap, count;
+  shard_state **shard;
+  int limit;
+  std::atomic<int> produced, consumed;
+  wait_sem space, ready;
+  std::atomic<int> refills; ///< Bumped after every refill; futex word for stalled gets.
+  std::atomic<int> stalled; ///< Gets parked on refills.
+  wait_policy policy;
+};
+
+#endif // SHARDED_BUFFER_HPP
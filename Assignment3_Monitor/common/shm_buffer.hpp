@@ -0,0 +1,362 @@
+#ifndef SHM_BUFFER_HPP
+#define SHM_BUFFER_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// Role a process attaches with.
+enum class shm_role { producer, consumer };
+
+/// Layout at the start of the shared memory object; the slots follow it.
+///
+/// Every field is protected by `lock`, a process-shared robust mutex. head
+/// and tail only move after a slot has been completely copied, so a process
+/// that dies while holding the lock leaves the ring consistent: an unfinished
+/// put is simply not visible and an unfinished get is delivered again.
+struct shm_header {
+  static const uint32_t MAGIC = 0x53484d51; // "SHMQ"
+  enum { MAX_PEERS = 64 };
+
+  uint32_t magic;   ///< Written last by the creator; attachers wait for it.
+  int capacity;     ///< Number of slots.
+  int slotSize;     ///< Largest item in bytes.
+  pthread_mutex_t lock;
+  pthread_cond_t notFull, notEmpty;
+  uint64_t head;    ///< Items taken so far; next read is head % capacity.
+  uint64_t tail;    ///< Items put so far; next write is tail % capacity.
+  int producers;    ///< Producers that must finish before the stream closes.
+  int finished;     ///< Producers that have called finish().
+  int closed;       ///< No more puts; gets drain and then fail.
+  pid_t peers[MAX_PEERS];
+  shm_role roles[MAX_PEERS];
+};
+
+/// Bounded buffer of variable-length byte items living in a POSIX shared
+/// memory object, so producers and consumers can be separate processes.
+///
+/// The stream closes only on an explicit end of stream: once as many
+/// producers as create() was told to expect have called finish(), or when
+/// close() is called. A producer that detaches or dies without finishing
+/// does not count, so a restarted producer can attach and take its place.
+/// Waits use a short timeout so dead peers leave the peer table even if no
+/// live process ever signals again.
+class shm_buffer {
+public:
+  enum { RECHECK_MS = 100 };
+
+  /// Creates and initializes the named segment for the given number of
+  /// producers. Fails with EEXIST if it already exists. Returns NULL with
+  /// errno set on failure.
+  static shm_buffer *create(const char *name, int capacity, int slot_size, int producers = 1) {
+    if (capacity < 1 || slot_size < 1 || producers < 1) {
+      errno = EINVAL;
+      return NULL;
+    }
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+      return NULL;
+    }
+    size_t size = sizeof(shm_header) + (size_t)capacity * slot_stride(slot_size);
+    if (ftruncate(fd, size) == -1) {
+      int err = errno;
+      close_fd_and_unlink(fd, name);
+      errno = err;
+      return NULL;
+    }
+    shm_header *hdr = (shm_header *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+      int err = errno;
+      close_fd_and_unlink(fd, name);
+      errno = err;
+      return NULL;
+    }
+
+    memset(hdr, 0, sizeof(shm_header));
+    hdr->capacity = capacity;
+    hdr->slotSize = slot_size;
+    hdr->producers = producers;
+
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&hdr->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&hdr->notFull, &cattr);
+    pthread_cond_init(&hdr->notEmpty, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    __atomic_store_n(&hdr->magic, shm_header::MAGIC, __ATOMIC_RELEASE);
+    return new shm_buffer(fd, hdr, size);
+  }
+
+  /// Maps an existing segment created by create(). Returns NULL with errno
+  /// set on failure (EPROTO if the segment is not a buffer, EUSERS if the
+  /// peer table is full, ENOTRECOVERABLE if its lock is unusable).
+  static shm_buffer *attach(const char *name, shm_role role) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+      return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(shm_header)) {
+      ::close(fd);
+      errno = EPROTO;
+      return NULL;
+    }
+    shm_header *hdr = (shm_header *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+      int err = errno;
+      ::close(fd);
+      errno = err;
+      return NULL;
+    }
+    shm_buffer *buf = new shm_buffer(fd, hdr, st.st_size);
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != shm_header::MAGIC ||
+        sizeof(shm_header) + (size_t)hdr->capacity * slot_stride(hdr->slotSize) > (size_t)st.st_size) {
+      delete buf;
+      errno = EPROTO;
+      return NULL;
+    }
+    if (!buf->join(role)) {
+      int err = errno;
+      delete buf;
+      errno = err;
+      return NULL;
+    }
+    return buf;
+  }
+
+  /// Removes the name; mapped processes keep working until they detach.
+  static int destroy(const char *name) { return shm_unlink(name); }
+
+  /// Leaves the peer table and unmaps the segment. Detaching does not end
+  /// the stream; producers call finish() for that.
+  ~shm_buffer() {
+    if (peer >= 0 && lock()) {
+      if (hdr->peers[peer] == getpid()) {
+        hdr->peers[peer] = 0;
+      }
+      pthread_mutex_unlock(&hdr->lock);
+    }
+    munmap(hdr, size);
+    ::close(fd);
+  }
+
+  shm_buffer(const shm_buffer &) = delete;
+  shm_buffer &operator=(const shm_buffer &) = delete;
+
+  int capacity() const { return hdr->capacity; }
+  int slot_size() const { return hdr->slotSize; }
+
+  /// Copies len bytes into the next free slot, waiting while the ring is
+  /// full. Returns the slot index, or -1 if the stream is closed (or len is
+  /// larger than a slot, with errno EMSGSIZE, or the lock is unusable, with
+  /// errno ENOTRECOVERABLE).
+  int put(const void *data, int len) {
+    if (len < 0 || len > hdr->slotSize) {
+      errno = EMSGSIZE;
+      return -1;
+    }
+    if (!lock()) {
+      return -1;
+    }
+    while (!hdr->closed && hdr->tail - hdr->head == (uint64_t)hdr->capacity) {
+      if (!wait(&hdr->notFull)) {
+        return -1;
+      }
+    }
+    if (hdr->closed) {
+      pthread_mutex_unlock(&hdr->lock);
+      return -1;
+    }
+    int slot = hdr->tail % hdr->capacity;
+    char *dst = slot_at(slot);
+    memcpy(dst, &len, sizeof(int));
+    memcpy(dst + sizeof(int), data, len);
+    hdr->tail++;
+    pthread_cond_signal(&hdr->notEmpty);
+    pthread_mutex_unlock(&hdr->lock);
+    return slot;
+  }
+
+  /// Copies the oldest item into data (at most max bytes), waiting while the
+  /// ring is empty. Stores the length in *len and returns the slot index, or
+  /// -1 once the stream is closed and drained (or with errno
+  /// ENOTRECOVERABLE if the lock is unusable).
+  int get(void *data, int max, int *len) {
+    if (!lock()) {
+      return -1;
+    }
+    while (!hdr->closed && hdr->tail == hdr->head) {
+      if (!wait(&hdr->notEmpty)) {
+        return -1;
+      }
+    }
+    if (hdr->tail == hdr->head) {
+      pthread_mutex_unlock(&hdr->lock);
+      return -1;
+    }
+    int slot = hdr->head % hdr->capacity;
+    const char *src = slot_at(slot);
+    memcpy(len, src, sizeof(int));
+    memcpy(data, src + sizeof(int), *len < max ? *len : max);
+    hdr->head++;
+    pthread_cond_signal(&hdr->notFull);
+    pthread_mutex_unlock(&hdr->lock);
+    return slot;
+  }
+
+  /// Declares that this producer is done; the last expected producer to
+  /// finish closes the stream. Returns -1 with errno EPERM if we did not
+  /// attach as a producer or have already finished.
+  int finish() {
+    if (!lock()) {
+      return -1;
+    }
+    if (peer < 0 || hdr->roles[peer] != shm_role::producer || finished) {
+      pthread_mutex_unlock(&hdr->lock);
+      errno = EPERM;
+      return -1;
+    }
+    finished = true;
+    if (++hdr->finished >= hdr->producers) {
+      close_locked();
+    }
+    pthread_mutex_unlock(&hdr->lock);
+    return 0;
+  }
+
+  /// Ends the stream: blocked producers fail, consumers drain and then fail.
+  int close() {
+    if (!lock()) {
+      return -1;
+    }
+    close_locked();
+    pthread_mutex_unlock(&hdr->lock);
+    return 0;
+  }
+
+private:
+  shm_buffer(int fd, shm_header *hdr, size_t size) : fd(fd), hdr(hdr), size(size), peer(-1), finished(false) {}
+
+  static size_t slot_stride(int slot_size) {
+    return (sizeof(int) + slot_size + 7) & ~(size_t)7;
+  }
+
+  static void close_fd_and_unlink(int fd, const char *name) {
+    ::close(fd);
+    shm_unlink(name);
+  }
+
+  char *slot_at(int slot) const {
+    return (char *)(hdr + 1) + (size_t)slot * slot_stride(hdr->slotSize);
+  }
+
+  /// Locks the header. If the previous owner died holding it, drops dead
+  /// peers and marks the mutex consistent; the ring itself needs no repair.
+  /// Returns false, without the lock and with errno ENOTRECOVERABLE, if an
+  /// earlier owner died and the mutex was never made consistent.
+  bool lock() {
+    int err = pthread_mutex_lock(&hdr->lock);
+    if (err == EOWNERDEAD) {
+      reap();
+      pthread_mutex_consistent(&hdr->lock);
+    } else if (err) {
+      errno = err;
+      return false;
+    }
+    return true;
+  }
+
+  /// Waits on cond for at most RECHECK_MS, then reaps dead peers. Returns
+  /// false, without the lock, if the mutex became unrecoverable.
+  bool wait(pthread_cond_t *cond) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += RECHECK_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    int err = pthread_cond_timedwait(cond, &hdr->lock, &deadline);
+    if (err == ENOTRECOVERABLE) {
+      errno = err;
+      return false;
+    }
+    if (err == EOWNERDEAD) {
+      pthread_mutex_consistent(&hdr->lock);
+    }
+    if (err) {
+      reap();
+    }
+    return true;
+  }
+
+  void close_locked() {
+    hdr->closed = 1;
+    pthread_cond_broadcast(&hdr->notFull);
+    pthread_cond_broadcast(&hdr->notEmpty);
+  }
+
+  /// Takes a free entry in the peer table. Returns false with errno EUSERS
+  /// if the table is full.
+  bool join(shm_role role) {
+    if (!lock()) {
+      return false;
+    }
+    int i = 0;
+    while (i < shm_header::MAX_PEERS && hdr->peers[i] != 0) {
+      i++;
+    }
+    if (i == shm_header::MAX_PEERS) {
+      reap();
+      i = 0;
+      while (i < shm_header::MAX_PEERS && hdr->peers[i] != 0) {
+        i++;
+      }
+    }
+    if (i < shm_header::MAX_PEERS) {
+      hdr->peers[i] = getpid();
+      hdr->roles[i] = role;
+      peer = i;
+    }
+    pthread_mutex_unlock(&hdr->lock);
+    if (peer < 0) {
+      errno = EUSERS;
+      return false;
+    }
+    return true;
+  }
+
+  /// Drops peers whose process no longer exists; must hold the lock.
+  void reap() {
+    for (int i = 0; i < shm_header::MAX_PEERS; i++) {
+      pid_t pid = hdr->peers[i];
+      if (pid != 0 && kill(pid, 0) == -1 && errno == ESRCH) {
+        hdr->peers[i] = 0;
+      }
+    }
+  }
+
+  int fd;
+  shm_header *hdr;
+  size_t size;
+  int peer;      ///< Our entry in the peer table, or -1.
+  bool finished; ///< Whether we have called finish().
+};
+
+#endif // SHM_BUFFER_HPP
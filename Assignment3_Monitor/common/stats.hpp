@@ -0,0 +1,53 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/// Wall-clock and CPU bookkeeping for one producer/consumer run.
+struct run_stats {
+  struct timespec start;
+  struct timespec stop;
+  struct rusage startUsage;
+  struct rusage stopUsage;
+};
+
+/// Records the start of the measured region.
+inline void stats_start(run_stats *stats) {
+  getrusage(RUSAGE_SELF, &stats->startUsage);
+  clock_gettime(CLOCK_MONOTONIC, &stats->start);
+}
+
+/// Records the end of the measured region.
+inline void stats_stop(run_stats *stats) {
+  clock_gettime(CLOCK_MONOTONIC, &stats->stop);
+  getrusage(RUSAGE_SELF, &stats->stopUsage);
+}
+
+/// Seconds between stats_start and stats_stop.
+inline double stats_elapsed(const run_stats *stats) {
+  return (stats->stop.tv_sec - stats->start.tv_sec) +
+         (stats->stop.tv_nsec - stats->start.tv_nsec) / 1e9;
+}
+
+/// Seconds between two timevals.
+inline double stats_seconds(const struct timeval &from, const struct timeval &to) {
+  return (to.tv_sec - from.tv_sec) + (to.tv_usec - from.tv_usec) / 1e6;
+}
+
+/// User plus system CPU seconds spent by all threads during the run.
+inline double stats_cpu(const run_stats *stats) {
+  return stats_seconds(stats->startUsage.ru_utime, stats->stopUsage.ru_utime) +
+         stats_seconds(stats->startUsage.ru_stime, stats->stopUsage.ru_stime);
+}
+
+/// Prints a one-line throughput summary to stderr so it never mixes with the
+/// item trace on stdout.
+inline void stats_report(const run_stats *stats, const char *prog, long items, int batch) {
+  double secs = stats_elapsed(stats);
+  fprintf(stderr, "%s: items %ld, batch %d, %.6f s, %.0f items/s, cpu %.6f s\n",
+          prog, items, batch, secs, secs > 0 ? items / secs : 0.0, stats_cpu(stats));
+}
+
+#endif // STATS_HPP
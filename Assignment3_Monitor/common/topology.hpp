@@ -0,0 +1,221 @@
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "trace.hpp"
+#include "wait_sem.hpp"
+
+/// Where producer and consumer threads go (--pin).
+enum class pin_mode {
+  none,    ///< Leave placement to the kernel.
+  compact, ///< Fill one core's SMT siblings, then the next core, then the next socket.
+  scatter, ///< One thread per socket in turn, then per core, SMT siblings last.
+  pair     ///< Producer i and consumer i share core i: sibling threads if it has them.
+};
+
+/// Parses "none", "compact", "scatter" or "pair". Returns false on anything else.
+inline bool parse_pin_mode(const char *name, pin_mode *mode) {
+  if (!strcmp(name, "none")) {
+    *mode = pin_mode::none;
+  } else if (!strcmp(name, "compact")) {
+    *mode = pin_mode::compact;
+  } else if (!strcmp(name, "scatter")) {
+    *mode = pin_mode::scatter;
+  } else if (!strcmp(name, "pair")) {
+    *mode = pin_mode::pair;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/// The CPUs this process may run on, grouped into cores and sockets as
+/// /sys/devices/system/cpu/cpuN/topology describes them. Without sysfs
+/// every CPU counts as its own core on socket 0.
+class cpu_topology {
+public:
+  cpu_topology() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+      return;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        cpu_info info = {cpu, read_id(cpu, "core_id", cpu), read_id(cpu, "physical_package_id", 0), 0, 0};
+        cpus.push_back(info);
+      }
+    }
+    // Compact order; number the cores and each core's siblings along it.
+    std::sort(cpus.begin(), cpus.end(), [](const cpu_info &a, const cpu_info &b) {
+      return a.package != b.package ? a.package < b.package : a.core != b.core ? a.core < b.core : a.cpu < b.cpu;
+    });
+    for (size_t i = 0; i < cpus.size(); i++) {
+      bool sameCore = i > 0 && cpus[i].package == cpus[i - 1].package && cpus[i].core == cpus[i - 1].core;
+      if (!sameCore) {
+        cores.push_back(i);
+      }
+      cpus[i].sibling = sameCore ? cpus[i - 1].sibling + 1 : 0;
+      cpus[i].coreRank = sameCore ? cpus[i - 1].coreRank
+                         : i > 0 && cpus[i].package == cpus[i - 1].package ? cpus[i - 1].coreRank + 1 : 0;
+    }
+    spread = cpus;
+    std::stable_sort(spread.begin(), spread.end(), [](const cpu_info &a, const cpu_info &b) {
+      return a.sibling != b.sibling ? a.sibling < b.sibling : a.coreRank < b.coreRank;
+    });
+  }
+
+  int size() const { return cpus.size(); }
+  int core_count() const { return cores.size(); }
+
+  /// CPU for the index-th producer (or consumer), or -1 under pin_mode::none.
+  /// Threads are numbered producers first, then consumers, for compact and
+  /// scatter; pair matches producer i with consumer i.
+  int place(pin_mode mode, bool consumer, int index, int producers) const {
+    if (cpus.empty() || mode == pin_mode::none) {
+      return -1;
+    }
+    int n = cpus.size();
+    int thread = consumer ? producers + index : index;
+    switch (mode) {
+      case pin_mode::compact: return cpus[thread % n].cpu;
+      case pin_mode::scatter: return spread[thread % n].cpu;
+      default: break;
+    }
+    size_t first = cores[index % cores.size()];
+    size_t next = first + 1;
+    bool hasSibling = next < cpus.size() && cpus[next].sibling > 0;
+    return cpus[consumer && hasSibling ? next : first].cpu;
+  }
+
+  /// "cpu N (socket S, core C)" for reports.
+  void describe(int cpu, char *out, size_t len) const {
+    for (size_t i = 0; i < cpus.size(); i++) {
+      if (cpus[i].cpu == cpu) {
+        snprintf(out, len, "cpu %d (socket %d, core %d)", cpu, cpus[i].package, cpus[i].core);
+        return;
+      }
+    }
+    snprintf(out, len, "unpinned");
+  }
+
+private:
+  struct cpu_info {
+    int cpu, core, package;
+    int sibling;  ///< Index among the CPUs of the same core.
+    int coreRank; ///< Index of the core within its socket.
+  };
+
+  static int read_id(int cpu, const char *name, int fallback) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    FILE *f = fopen(path, "r");
+    int id = fallback;
+    if (f) {
+      if (fscanf(f, "%d", &id) != 1) {
+        id = fallback;
+      }
+      fclose(f);
+    }
+    return id;
+  }
+
+  std::vector<cpu_info> cpus;   ///< Compact order: socket, core, CPU.
+  std::vector<cpu_info> spread; ///< Scatter order: sibling, core, socket.
+  std::vector<size_t> cores;    ///< Index in cpus of each core's first CPU.
+};
+
+/// Restricts thread t to one CPU; cpu < 0 leaves it alone. Returns false if
+/// the kernel refused.
+inline bool pin_thread(pthread_t t, int cpu) {
+  if (cpu < 0) {
+    return true;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(t, sizeof(set), &set) == 0;
+}
+
+/// One cache line bounced between two pinned threads.
+struct handoff_line {
+  alignas(64) std::atomic<long> turn;
+  long rounds;
+  int cpu;
+};
+
+/// Spins, then yields so that both ends can share one CPU.
+inline void handoff_backoff(unsigned i) {
+  if (i < 64) {
+    cpu_relax();
+  } else {
+    sched_yield();
+  }
+}
+
+inline void *handoff_echo(void *arg) {
+  handoff_line *line = (handoff_line *)arg;
+  pin_thread(pthread_self(), line->cpu);
+  for (long r = 0; r < line->rounds; r++) {
+    for (unsigned i = 0; line->turn.load(std::memory_order_acquire) != 2 * r + 1; i++) {
+      handoff_backoff(i);
+    }
+    line->turn.store(2 * r + 2, std::memory_order_release);
+  }
+  return NULL;
+}
+
+/// Mean one-way time, in nanoseconds, to hand a cache line from CPU a to
+/// CPU b and back, halved: the cost a producer/consumer pair placed there
+/// pays on every item. Returns a negative value if a thread cannot start.
+inline double handoff_ns(int a, int b, long rounds) {
+  handoff_line line;
+  line.turn.store(0);
+  line.rounds = rounds;
+  line.cpu = b;
+  pthread_t echo;
+  if (pthread_create(&echo, NULL, handoff_echo, &line)) {
+    return -1;
+  }
+  cpu_set_t saved;
+  pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved);
+  pin_thread(pthread_self(), a);
+
+  uint64_t start = trace_now();
+  for (long r = 0; r < rounds; r++) {
+    line.turn.store(2 * r + 1, std::memory_order_release);
+    for (unsigned i = 0; line.turn.load(std::memory_order_acquire) != 2 * r + 2; i++) {
+      handoff_backoff(i);
+    }
+  }
+  uint64_t elapsed = trace_now() - start;
+
+  pthread_join(echo, NULL);
+  pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+  return rounds > 0 ? elapsed / (2.0 * rounds) : 0;
+}
+
+/// Prints where --pin puts every thread and how long a cache line takes to
+/// cross between producer 1 and consumer 1, to stderr.
+inline void pin_report(const char *prog, const cpu_topology &topo, pin_mode mode, int producers, int consumers) {
+  char where[64];
+  fprintf(stderr, "%s: %d cpus on %d cores\n", prog, topo.size(), topo.core_count());
+  for (int i = 0; i < producers + consumers; i++) {
+    bool consumer = i >= producers;
+    int index = consumer ? i - producers : i;
+    topo.describe(topo.place(mode, consumer, index, producers), where, sizeof(where));
+    fprintf(stderr, "%s: %s %d on %s\n", prog, consumer ? "consumer" : "producer", index + 1, where);
+  }
+  int from = topo.place(mode, false, 0, producers), to = topo.place(mode, true, 0, producers);
+  fprintf(stderr, "%s: cache-line handoff producer 1 -> consumer 1: %.1f ns\n", prog, handoff_ns(from, to, 100000));
+}
+
+#endif // TOPOLOGY_HPP
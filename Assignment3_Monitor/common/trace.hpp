@@ -0,0 +1,107 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/// Records per chunk; a chunk is allocated only when the previous one fills.
+const int TRACE_CHUNK = 4096;
+
+/// One produce or consume event.
+struct trace_record {
+  uint64_t when; ///< CLOCK_MONOTONIC nanoseconds.
+  int id;        ///< Producer or consumer id.
+  int slot;      ///< Buffer index the item went into or came out of.
+  char kind;     ///< 'p' or 'c'.
+  char item;     ///< The item itself.
+};
+
+/// Append-only event log owned by a single thread. No locking: only the
+/// owner appends, and it is read only after the owner has been joined.
+struct trace_buffer {
+  std::vector<trace_record *> chunks;
+  int used = TRACE_CHUNK; ///< Records in the last chunk.
+};
+
+/// Current CLOCK_MONOTONIC time in nanoseconds.
+inline uint64_t trace_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// Prints one event in the producer/consumer trace format.
+inline void trace_print(FILE *out, char kind, int id, char item, int slot) {
+  fprintf(out, "%c:<%d>, item: %c, at %d\n", kind, id, item, slot);
+}
+
+/// Logs one event: straight to stdout when trace is NULL, otherwise as a
+/// fixed-size binary record in the calling thread's buffer.
+inline void trace_event(trace_buffer *trace, char kind, int id, char item, int slot) {
+  if (!trace) {
+    trace_print(stdout, kind, id, item, slot);
+    return;
+  }
+  if (trace->used == TRACE_CHUNK) {
+    trace->chunks.push_back((trace_record *)malloc(sizeof(trace_record) * TRACE_CHUNK));
+    trace->used = 0;
+  }
+  trace_record *rec = &trace->chunks.back()[trace->used++];
+  rec->when = trace_now();
+  rec->id = id;
+  rec->slot = slot;
+  rec->kind = kind;
+  rec->item = item;
+}
+
+/// Number of records held by a buffer.
+inline size_t trace_size(const trace_buffer *trace) {
+  return trace->chunks.empty() ? 0 : (trace->chunks.size() - 1) * TRACE_CHUNK + trace->used;
+}
+
+/// Record at position i of a buffer.
+inline const trace_record *trace_at(const trace_buffer *trace, size_t i) {
+  return &trace->chunks[i / TRACE_CHUNK][i % TRACE_CHUNK];
+}
+
+/// Merges the buffers by timestamp and prints them in the live trace format.
+/// Each buffer is already in time order, so this is a k-way merge.
+inline void trace_flush(trace_buffer *buffers, int count, FILE *out) {
+  typedef std::pair<uint64_t, std::pair<int, size_t> > cursor; // (when, (buffer, index))
+  std::priority_queue<cursor, std::vector<cursor>, std::greater<cursor> > heads;
+
+  for (int b = 0; b < count; b++) {
+    if (trace_size(&buffers[b]) > 0) {
+      heads.push(cursor(trace_at(&buffers[b], 0)->when, std::make_pair(b, (size_t)0)));
+    }
+  }
+  while (!heads.empty()) {
+    int b = heads.top().second.first;
+    size_t i = heads.top().second.second;
+    heads.pop();
+
+    const trace_record *rec = trace_at(&buffers[b], i);
+    trace_print(out, rec->kind, rec->id, rec->item, rec->slot);
+    if (++i < trace_size(&buffers[b])) {
+      heads.push(cursor(trace_at(&buffers[b], i)->when, std::make_pair(b, i)));
+    }
+  }
+}
+
+/// Releases the chunks held by a buffer.
+inline void trace_free(trace_buffer *trace) {
+  for (size_t i = 0; i < trace->chunks.size(); i++) {
+    free(trace->chunks[i]);
+  }
+  trace->chunks.clear();
+  trace->used = TRACE_CHUNK;
+}
+
+#endif // TRACE_HPP
@@ -0,0 +1,117 @@
+#ifndef VERIFY_HPP
+#define VERIFY_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Item that carries its origin: producer id and that producer's sequence
+/// number, starting at 0. Trivially copyable, so moving it is free.
+struct stamped_item {
+  int producer;
+  unsigned seq;
+};
+
+/// Running tallies over the stream of one producer, as seen by one thread.
+///
+/// Consumers fold every item they get. A producer only counts what it put:
+/// its stream is 0, 1, ..., count - 1, so verify_expect() rebuilds the rest
+/// after the run, off the clock. The stream arrived exactly once when the
+/// consumers' tallies add up to that. The count catches losses, the sum and
+/// the XOR of the sequence numbers catch duplicates standing in for losses,
+/// and `late` counts items whose sequence number was not above the
+/// last one the thread saw from the same producer (reordered or repeated).
+struct verify_tally {
+  long count;
+  uint64_t sum, xored; ///< Sum and XOR of the sequence numbers.
+  long last;           ///< Last sequence number seen, -1 before the first.
+  long late;
+};
+
+/// Folds one sequence number into a tally.
+inline void verify_fold(verify_tally *t, unsigned seq) {
+  t->count++;
+  t->sum += seq;
+  t->xored ^= seq;
+  if ((long)seq <= t->last) {
+    t->late++;
+  }
+  t->last = seq;
+}
+
+/// 0 ^ 1 ^ ... ^ (n - 1), which repeats with period 4.
+inline uint64_t verify_xor_upto(long n) {
+  uint64_t last = n - 1;
+  switch (n & 3) {
+    case 0: return 0;
+    case 1: return last;
+    case 2: return 1;
+    default: return last + 1;
+  }
+}
+
+/// Fills t with the tally of a whole stream of `count` items, as produced.
+inline void verify_expect(verify_tally *t, long count) {
+  t->count = count;
+  t->sum = count > 0 ? (uint64_t)count * (count - 1) / 2 : 0;
+  t->xored = verify_xor_upto(count);
+  t->last = count - 1;
+  t->late = 0;
+}
+
+/// Adds tally b into a; order is per thread, so only `late` carries over.
+inline void verify_merge(verify_tally *a, const verify_tally *b) {
+  a->count += b->count;
+  a->sum += b->sum;
+  a->xored ^= b->xored;
+  a->late += b->late;
+}
+
+/// Whether `got` received exactly the items `sent` put, each once.
+inline bool verify_match(const verify_tally *sent, const verify_tally *got) {
+  return sent->count == got->count && sent->sum == got->sum && sent->xored == got->xored && got->late == 0;
+}
+
+/// One row of tallies per thread, one tally per producer in each row. Rows
+/// start on their own cache line and each is only written by its thread,
+/// so folding costs a few arithmetic instructions and no sharing.
+class verify_ledger {
+public:
+  verify_ledger(int threads, int producers) : numProds(producers) {
+    stride = (producers * sizeof(verify_tally) + 63) / 64 * 64;
+    void *mem = NULL;
+    if (posix_memalign(&mem, 64, stride * threads)) {
+      mem = NULL;
+    }
+    rows = (char *)mem;
+    for (int i = 0; rows && i < threads; i++) {
+      clear(row(i));
+    }
+  }
+
+  ~verify_ledger() { free(rows); }
+
+  verify_ledger(const verify_ledger &) = delete;
+  verify_ledger &operator=(const verify_ledger &) = delete;
+
+  bool ok() const { return rows != NULL; }
+  int producers() const { return numProds; }
+
+  /// The tallies of thread i, indexed by producer id - 1.
+  verify_tally *row(int i) { return (verify_tally *)(rows + i * stride); }
+
+  /// Fills t with empty tallies, one per producer.
+  void clear(verify_tally *t) const {
+    memset(t, 0, numProds * sizeof(verify_tally));
+    for (int p = 0; p < numProds; p++) {
+      t[p].last = -1;
+    }
+  }
+
+private:
+  int numProds;
+  size_t stride;
+  char *rows;
+};
+
+#endif // VERIFY_HPP
@@ -0,0 +1,217 @@
+#ifndef WAIT_SEM_HPP
+#define WAIT_SEM_HPP
+
+#include <limits.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+
+/// How a thread waits for a permit that is not available yet.
+enum class wait_policy {
+  block,   ///< Park in the kernel straight away (what sem_wait does).
+  spin,    ///< Never park: spin with a CPU pause hint, yielding now and then.
+  adaptive ///< Spin for a self-tuning budget, then yield, then park.
+};
+
+/// Parses "block", "spin" or "adaptive". Returns false on anything else.
+inline bool parse_wait_policy(const char *name, wait_policy *policy) {
+  if (!strcmp(name, "block")) {
+    *policy = wait_policy::block;
+  } else if (!strcmp(name, "spin")) {
+    *policy = wait_policy::spin;
+  } else if (!strcmp(name, "adaptive")) {
+    *policy = wait_policy::adaptive;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/// Tells the CPU we are in a spin loop (frees pipeline resources for an SMT
+/// sibling and saves power).
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+inline int futex_wait(std::atomic<int> *word, int expected, const struct timespec *timeout = NULL) {
+  return syscall(SYS_futex, (int *)word, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+inline int futex_wake(std::atomic<int> *word, int count) {
+  return syscall(SYS_futex, (int *)word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/// Counting semaphore on a futex word with a selectable wait policy.
+///
+/// Unlike sem_t it can take several permits in one step (wait_up_to) and
+/// release several with one atomic add and at most one wake-up call (post).
+/// Posting never enters the kernel unless a waiter is actually parked.
+///
+/// A semaphore can also be closed: waiters still take whatever permits are
+/// left, and once there are none, every wait returns 0 instead of blocking.
+/// The closed flag lives in the futex word, so close() releases all parked
+/// waiters with a single wake-up call.
+class wait_sem {
+public:
+  enum {
+    MIN_SPIN = 16,    ///< Lower bound of the adaptive spin budget (pause iterations).
+    MAX_SPIN = 16384, ///< Upper bound of the adaptive spin budget.
+    YIELDS = 4,       ///< sched_yield rounds between spinning and parking.
+    CLOSED = 1 << 30  ///< Flag bit in count; permits use the bits below it.
+  };
+
+  wait_sem(int permits, wait_policy policy)
+      : count(permits), parked(0), spinBudget(MIN_SPIN), policy(policy) {
+    // With one CPU the other side cannot run while we spin.
+    if (sysconf(_SC_NPROCESSORS_ONLN) == 1) {
+      spinBudget = 0;
+    }
+  }
+
+  wait_sem(const wait_sem &) = delete;
+  wait_sem &operator=(const wait_sem &) = delete;
+
+  /// Takes up to max permits if any are available. Returns how many.
+  ///
+  /// The load is seq_cst because park() calls this right after its seq_cst
+  /// parked++: paired with post()'s seq_cst add and parked load, either the
+  /// poster sees us parked and wakes us, or we see its permit here.
+  int try_wait_up_to(int max) {
+    int cur = count.load(std::memory_order_seq_cst);
+    while ((cur & ~CLOSED) > 0) {
+      int avail = cur & ~CLOSED;
+      int take = avail < max ? avail : max;
+      if (count.compare_exchange_weak(cur, cur - take, std::memory_order_acquire)) {
+        return take;
+      }
+    }
+    return 0;
+  }
+
+  /// Waits for at least one permit, then takes up to max without waiting.
+  /// Returns 0 only once the semaphore is closed and out of permits.
+  int wait_up_to(int max) {
+    int taken = try_wait_up_to(max);
+    if (taken) {
+      return taken;
+    }
+    if (policy == wait_policy::spin) {
+      return spin_forever(max);
+    }
+    if (policy == wait_policy::adaptive && (taken = spin_then_yield(max))) {
+      return taken;
+    }
+    return park(max);
+  }
+
+  /// Returns false once the semaphore is closed and out of permits.
+  bool wait() { return wait_up_to(1) == 1; }
+
+  /// Releases n permits and wakes at most n parked waiters. Returns how
+  /// many permits were available just before, so callers can spot the
+  /// none-to-some transition.
+  int post(int n = 1) {
+    if (n <= 0) {
+      return count.load(std::memory_order_relaxed) & ~CLOSED;
+    }
+    int before = count.fetch_add(n, std::memory_order_seq_cst) & ~CLOSED;
+    if (parked.load(std::memory_order_seq_cst) > 0) {
+      futex_wake(&count, n);
+    }
+    return before;
+  }
+
+  /// Marks the semaphore closed and wakes every parked waiter. Permits
+  /// posted before or after still go to waiters.
+  void close() {
+    count.fetch_or(CLOSED, std::memory_order_seq_cst);
+    if (parked.load(std::memory_order_seq_cst) > 0) {
+      futex_wake(&count, INT_MAX);
+    }
+  }
+
+  /// Closed and out of permits: waits will not block any more.
+  bool drained() const { return count.load(std::memory_order_acquire) == CLOSED; }
+
+  /// Current spin budget (only meaningful for the adaptive policy).
+  int spin_budget() const { return spinBudget.load(std::memory_order_relaxed); }
+
+private:
+  int spin_forever(int max) {
+    int taken;
+    for (unsigned i = 1; !(taken = try_wait_up_to(max)); i++) {
+      if (drained()) {
+        return 0;
+      }
+      cpu_relax();
+      if (i % 64 == 0) {
+        sched_yield(); // so a single-CPU box still makes progress
+      }
+    }
+    return taken;
+  }
+
+  /// Spins for the current budget, then yields a few times.
+  ///
+  /// The budget follows recent wait durations, measured in pause iterations:
+  /// a wait that ended while spinning pulls it toward twice the spins it
+  /// needed (so it grows while waits end near the budget), and a wait that
+  /// outlasted the spin halves it. The floor keeps probing whether spinning
+  /// has started paying off again.
+  int spin_then_yield(int max) {
+    int budget = spinBudget.load(std::memory_order_relaxed);
+    int taken;
+    for (int i = 0; i < budget && !drained(); i++) {
+      cpu_relax();
+      if ((taken = try_wait_up_to(max))) {
+        int target = 2 * (i + 1);
+        target = target < MIN_SPIN ? MIN_SPIN : target > MAX_SPIN ? MAX_SPIN : target;
+        spinBudget.store((7 * budget + target) / 8, std::memory_order_relaxed);
+        return taken;
+      }
+    }
+    if (budget > MIN_SPIN) {
+      spinBudget.store(budget / 2 > MIN_SPIN ? budget / 2 : MIN_SPIN, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < YIELDS; i++) {
+      sched_yield();
+      if ((taken = try_wait_up_to(max))) {
+        return taken;
+      }
+    }
+    return 0;
+  }
+
+  /// Sleeps on the futex until a permit shows up or the semaphore closes.
+  int park(int max) {
+    parked.fetch_add(1, std::memory_order_seq_cst);
+    int taken;
+    while (!(taken = try_wait_up_to(max))) {
+      int cur = count.load(std::memory_order_seq_cst);
+      if (cur == CLOSED) {
+        break;
+      }
+      if (cur == 0) {
+        futex_wait(&count, 0);
+      }
+    }
+    parked.fetch_sub(1, std::memory_order_relaxed);
+    return taken;
+  }
+
+  std::atomic<int> count;  ///< Available permits; also the futex word.
+  std::atomic<int> parked; ///< Threads currently sleeping on the futex.
+  std::atomic<int> spinBudget;
+  wait_policy policy;
+};
+
+#endif // WAIT_SEM_HPP
@@ -0,0 +1,93 @@
+#ifndef WS_DEQUE_HPP
+#define WS_DEQUE_HPP
+
+#include <stddef.h>
+
+#include <atomic>
+#include <type_traits>
+
+/// Chase-Lev work-stealing deque of fixed capacity.
+///
+/// The owning thread pushes and pops at the bottom without taking a lock;
+/// any other thread may steal from the top, and only a steal racing a pop of
+/// the very last item costs a CAS. Memory orders follow Lê et al., "Correct
+/// and Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+///
+/// The array never grows: callers must bound the number of items in the
+/// deque by `capacity`. A thief may read a slot the owner is overwriting, but
+/// then its CAS on top fails and the value is thrown away. As in the paper
+/// the slots are atomics accessed with relaxed loads and stores, so that
+/// speculative read is not a data race; T must be trivially copyable.
+template <typename T>
+class ws_deque {
+  static_assert(std::is_trivially_copyable<T>::value, "ws_deque items are copied speculatively");
+
+public:
+  explicit ws_deque(int capacity) : top(0), bottom(0) {
+    size_t size = 1;
+    while (size < (size_t)capacity + 1) {
+      size *= 2;
+    }
+    slots = new std::atomic<T>[size];
+    mask = size - 1;
+  }
+
+  ~ws_deque() { delete[] slots; }
+
+  ws_deque(const ws_deque &) = delete;
+  ws_deque &operator=(const ws_deque &) = delete;
+
+  /// Owner only.
+  void push(const T &item) {
+    long b = bottom.load(std::memory_order_relaxed);
+    slots[b & mask].store(item, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /// Owner only. Takes the newest item; false if the deque is empty.
+  bool pop(T &item) {
+    long b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    item = slots[b & mask].load(std::memory_order_relaxed);
+    if (t == b) {
+      // Last item: race the thieves for it.
+      bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  /// Any thread. Takes the oldest item; false if the deque is empty or
+  /// another thread got there first.
+  bool steal(T &item) {
+    long t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+      return false;
+    }
+    T candidate = slots[t & mask].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return false;
+    }
+    item = candidate;
+    return true;
+  }
+
+private:
+  std::atomic<long> top;
+  char pad[64]; // keep thieves' top and the owner's bottom on separate lines
+  std::atomic<long> bottom;
+  std::atomic<T> *slots;
+  size_t mask;
+};
+
+#endif // WS_DEQUE_HPP
@@ -0,0 +1,117 @@
+// Producers and consumers as C++20 coroutines on a small thread pool.
+//
+// Every logical producer and consumer is a coroutine frame of a few hundred
+// bytes instead of a pthread with its own stack, and co_await on a full or
+// empty buffer suspends just that coroutine. -n sets the number of threads
+// that run them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <atomic>
+
+#include "co_buffer.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+char randAlpha();
+
+int bufSize, numProds, numCons, iToProd;
+int numThreads = 0;
+bool quiet = false, showStats = false;
+std::atomic<int> prodsLeft;
+std::atomic<long> consumed(0);
+
+void logSlot(char kind, int id, const char &item, int slot) {
+  trace_event(NULL, kind, id, item, slot);
+}
+
+co_task producer(co_buffer<char> *buffer, int id, int items) {
+  for (int i = 0; i < items; i++) {
+    if (!co_await buffer->put(randAlpha(), id)) {
+      break;
+    }
+  }
+  if (prodsLeft.fetch_sub(1) == 1) {
+    buffer->close();
+  }
+}
+
+co_task consumer(co_buffer<char> *buffer, int id) {
+  long taken = 0;
+  while (co_await buffer->get(id)) {
+    taken++;
+  }
+  consumed.fetch_add(taken);
+}
+
+char randAlpha() {
+  const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  char randomLetter = alphabet[random() % 52];
+  return randomLetter;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s -b <buffer_size> -p <num_producers> -c <num_consumers> -i <items_to_produce> [-n <threads>] [-q] [-s]\n", prog);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  bufSize = numProds = numCons = iToProd = -1;
+
+  while ((opt = getopt(argc, argv, "b:p:c:i:n:qs")) != -1) {
+    switch (opt) {
+      case 'b': bufSize = atoi(optarg); break;
+      case 'p': numProds = atoi(optarg); break;
+      case 'c': numCons = atoi(optarg); break;
+      case 'i': iToProd = atoi(optarg); break;
+      case 'n': numThreads = atoi(optarg); break;
+      case 'q': quiet = true; break;
+      case 's': showStats = true; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if (bufSize < 1 || numProds < 1 || numCons < 1 || iToProd < 0 || numThreads < 0) {
+    usage(argv[0]);
+  }
+  if (numThreads == 0) {
+    numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+
+  run_stats stats;
+  stats_start(&stats);
+
+  co_executor exec(numThreads);
+  co_buffer<char> buffer(bufSize, &exec, quiet ? NULL : logSlot);
+  prodsLeft = numProds;
+
+  // Split the items as evenly as possible over the producers.
+  for (int i = 0; i < numProds; i++) {
+    producer(&buffer, i + 1, iToProd / numProds + (i < iToProd % numProds)).start(&exec);
+  }
+  for (int i = 0; i < numCons; i++) {
+    consumer(&buffer, i + 1).start(&exec);
+  }
+  if (!exec.run()) {
+    fprintf(stderr, "Creation of an executor thread failed!\n");
+    return -1;
+  }
+
+  stats_stop(&stats);
+  if (consumed != iToProd) {
+    fprintf(stderr, "Consumed %ld of %d items!\n", consumed.load(), iToProd);
+    return -1;
+  }
+  if (showStats) {
+    stats_report(&stats, argv[0], iToProd, 1);
+    fprintf(stderr, "%s: %d producers, %d consumers on %d threads, max RSS %ld KiB\n",
+            argv[0], numProds, numCons, numThreads, stats.stopUsage.ru_maxrss);
+  }
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+// Producer/consumer over a durable, file-backed queue.
+//
+// Run it, kill it at any point, and run it again on the same file: the
+// consumers first drain whatever the last group commit made durable.
+//
+//   ./durq -f queue.dat -p 2 -c 2 -i 100000 -g 64 -W 1000
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "durable_queue.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+char randAlpha();
+
+pthread_t *prodThreads, *consThreads;
+durable_queue *queue;
+int bufSize = 1024, numProds, numCons, iToProd;
+int commitBatch = 64;
+long windowUs = 1000;
+bool quiet = false, showStats = false;
+std::atomic<int> ticket(0);
+std::atomic<long> consumed(0);
+
+void *producer(void *id) {
+  int *currentId = (int *) id;
+  // Tickets split -i exactly across the producers.
+  while (ticket.fetch_add(1) < iToProd) {
+    char item = randAlpha();
+    auto logSlot = [&](int slot) {
+      if (!quiet) {
+        trace_print(stdout, 'p', *currentId, item, slot);
+      }
+    };
+    if (queue->put(&item, 1, logSlot) < 0) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+void *consumer(void *id) {
+  int *currentCid = (int *) id;
+  char item;
+  int len;
+  long taken = 0;
+  auto logSlot = [&](int slot) {
+    if (!quiet) {
+      trace_print(stdout, 'c', *currentCid, item, slot);
+    }
+  };
+  while (queue->get(&item, 1, &len, logSlot) >= 0) {
+    taken++;
+  }
+  consumed += taken;
+  return NULL;
+}
+
+char randAlpha() {
+  const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  char randomLetter = alphabet[random() % 52];
+  return randomLetter;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s -f <file> -p <num_producers> -c <num_consumers> -i <items_to_produce> [-b <buffer_size>] [-g <commit_batch>] [-W <window_us>] [-q] [-s]\n", prog);
+  fprintf(stderr, "\t-b only applies when the file is created\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  const char *path = NULL;
+  numProds = numCons = iToProd = -1;
+
+  while ((opt = getopt(argc, argv, "f:b:p:c:i:g:W:qs")) != -1) {
+    switch (opt) {
+      case 'f': path = optarg; break;
+      case 'b': bufSize = atoi(optarg); break;
+      case 'p': numProds = atoi(optarg); break;
+      case 'c': numCons = atoi(optarg); break;
+      case 'i': iToProd = atoi(optarg); break;
+      case 'g': commitBatch = atoi(optarg); break;
+      case 'W': windowUs = atol(optarg); break;
+      case 'q': quiet = true; break;
+      case 's': showStats = true; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if (!path || bufSize < 1 || numProds < 0 || numCons < 1 || iToProd < 0 || commitBatch < 1 || windowUs < 1) {
+    usage(argv[0]);
+  }
+
+  queue = durable_queue::open(path, bufSize, 1, commitBatch, windowUs);
+  if (!queue) {
+    fprintf(stderr, "Opening %s failed: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (showStats && queue->recovered()) {
+    fprintf(stderr, "%s: resuming %ld committed items\n", argv[0], queue->recovered());
+  }
+
+  prodThreads = new pthread_t[numProds];
+  consThreads = new pthread_t[numCons];
+  int *pidList = new int[numProds];
+  int *cidList = new int[numCons];
+
+  run_stats stats;
+  stats_start(&stats);
+
+  for (int i = 0; i < numProds; i++) {
+    pidList[i] = i + 1;
+    if (pthread_create(&prodThreads[i], NULL, producer, &pidList[i])) {
+      fprintf(stderr, "Creation of producer thread %d failed!\n", pidList[i]);
+      return -1;
+    }
+  }
+  for (int i = 0; i < numCons; i++) {
+    cidList[i] = i + 1;
+    if (pthread_create(&consThreads[i], NULL, consumer, &cidList[i])) {
+      fprintf(stderr, "Creation of consumer thread %d failed!\n", cidList[i]);
+      return -1;
+    }
+  }
+
+  for (int i = 0; i < numProds; i++) {
+    pthread_join(prodThreads[i], NULL);
+  }
+  queue->close();
+  for (int i = 0; i < numCons; i++) {
+    pthread_join(consThreads[i], NULL);
+  }
+
+  stats_stop(&stats);
+  if (queue->error()) {
+    fprintf(stderr, "Committing to %s failed: %s\n", path, strerror(queue->error()));
+  }
+  if (showStats) {
+    stats_report(&stats, argv[0], iToProd, commitBatch);
+    fprintf(stderr, "%s: consumed %ld, %ld commits, %.1f items per commit\n", argv[0], consumed.load(),
+            queue->commits(), queue->commits() ? (double)queue->committed_items() / queue->commits() : 0.0);
+  }
+
+  delete queue;
+  delete[] prodThreads;
+  delete[] consThreads;
+  delete[] pidList;
+  delete[] cidList;
+  return 0;
+}
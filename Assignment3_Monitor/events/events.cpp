@@ -0,0 +1,176 @@
+// One epoll thread consuming from many bounded buffers.
+//
+// Each buffer gets its own producer thread; a single consumer thread waits on
+// every buffer's "not empty" eventfd plus a timerfd in one epoll set, so no
+// consumer thread is tied to a queue.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include <vector>
+
+#include "bounded_buffer.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+char randAlpha();
+
+int numBufs = 8, bufSize = 16, iToProd = 1000;
+int batchSize = 1;
+wait_policy waitPolicy = wait_policy::block;
+bool quiet = false, showStats = false;
+std::vector<bounded_buffer<char> *> buffers;
+
+void *producer(void *id) {
+  int *currentId = (int *) id;
+  bounded_buffer<char> *buffer = buffers[*currentId - 1];
+  char *items = new char[batchSize];
+
+  auto logSlot = [&](char c, int slot) {
+    if (!quiet) {
+      trace_event(NULL, 'p', *currentId, c, slot);
+    }
+  };
+  do {
+    for (int i = 0; i < batchSize; i++) {
+      items[i] = randAlpha();
+    }
+  } while (buffer->put_n(items, batchSize, logSlot) > 0);
+
+  delete[] items;
+  return NULL;
+}
+
+char randAlpha() {
+  const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  char randomLetter = alphabet[random() % 52];
+  return randomLetter;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-n <buffers>] [-b <buffer_size>] [-i <items_per_buffer>] [-k <batch_size>] [-w block|spin|adaptive] [-q] [-s]\n", prog);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  while ((opt = getopt(argc, argv, "n:b:i:k:w:qs")) != -1) {
+    switch (opt) {
+      case 'n': numBufs = atoi(optarg); break;
+      case 'b': bufSize = atoi(optarg); break;
+      case 'i': iToProd = atoi(optarg); break;
+      case 'k': batchSize = atoi(optarg); break;
+      case 'w':
+        if (!parse_wait_policy(optarg, &waitPolicy)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'q': quiet = true; break;
+      case 's': showStats = true; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (numBufs < 1 || bufSize < 1 || iToProd < 0 || batchSize < 1) {
+    usage(argv[0]);
+  }
+  if (batchSize > bufSize) {
+    batchSize = bufSize;
+  }
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd == -1) {
+    perror("epoll_create1");
+    return -1;
+  }
+  for (int i = 0; i < numBufs; i++) {
+    bounded_buffer<char> *buffer = new bounded_buffer<char>(bufSize, iToProd, waitPolicy);
+    if (!buffer->enable_events()) {
+      perror("eventfd");
+      return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u32 = i;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, buffer->not_empty_fd(), &ev);
+    buffers.push_back(buffer);
+  }
+
+  // A periodic timer in the same set, standing in for the sockets and
+  // timers a real event loop would also be serving.
+  int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct itimerspec period = {{0, 100000000}, {0, 100000000}};
+  timerfd_settime(tfd, 0, &period, NULL);
+  struct epoll_event tev;
+  tev.events = EPOLLIN;
+  tev.data.u32 = numBufs;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &tev);
+
+  run_stats stats;
+  stats_start(&stats);
+
+  std::vector<pthread_t> prodThreads(numBufs);
+  std::vector<int> pidList(numBufs);
+  for (int i = 0; i < numBufs; i++) {
+    pidList[i] = i + 1;
+    if (pthread_create(&prodThreads[i], NULL, producer, &pidList[i])) {
+      fprintf(stderr, "Creation of producer thread %d failed!\n", pidList[i]);
+      return -1;
+    }
+  }
+
+  // The consumer: this thread, waiting on everything at once.
+  char *items = new char[batchSize];
+  int open = numBufs, buf = 0;
+  long consumed = 0, wakeups = 0, ticks = 0;
+  auto logSlot = [&](char c, int slot) {
+    if (!quiet) {
+      trace_event(NULL, 'c', buf + 1, c, slot);
+    }
+  };
+  std::vector<struct epoll_event> events(numBufs + 1);
+  while (open > 0) {
+    int ready = epoll_wait(epfd, &events[0], events.size(), -1);
+    for (int e = 0; e < ready; e++) {
+      buf = events[e].data.u32;
+      if (buf == numBufs) {
+        bounded_buffer<char>::ack(tfd);
+        ticks++;
+        continue;
+      }
+      wakeups++;
+      bounded_buffer<char> *buffer = buffers[buf];
+      bounded_buffer<char>::ack(buffer->not_empty_fd());
+      int count;
+      while ((count = buffer->try_get_n(items, batchSize, logSlot)) > 0) {
+        consumed += count;
+      }
+      if (count < 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, buffer->not_empty_fd(), NULL);
+        open--;
+      }
+    }
+  }
+
+  for (int i = 0; i < numBufs; i++) {
+    pthread_join(prodThreads[i], NULL);
+  }
+  stats_stop(&stats);
+  if (showStats) {
+    stats_report(&stats, argv[0], consumed, batchSize);
+    fprintf(stderr, "%s: %d buffers, %ld wake-ups, %.1f items per wake-up, %ld timer ticks\n",
+            argv[0], numBufs, wakeups, wakeups ? (double)consumed / wakeups : 0.0, ticks);
+  }
+
+  delete[] items;
+  for (int i = 0; i < numBufs; i++) {
+    delete buffers[i];
+  }
+  close(tfd);
+  close(epfd);
+  return 0;
+}
@@ -3,97 +3,132 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <getopt.h>
 #include <unistd.h>
 
+#include "bounded_buffer.hpp"
+#include "stats.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
+
 void *producer(void *id);
 void *consumer(void *id);
 void initializeResources(int argc, char *argv[]);
 void cleanupResources();
 
 pthread_t *prodThreads, *consThreads;
-sem_t mutex, empty, full;
-char *buf;
+bounded_buffer<char> *buffer;
 char item = 'X';
 int bSize, nProds, nCons, iToProd;
-int inIndex = 0, outIndex = 0;
-int prodCount = 0, consCount = 0;
+int batchSize = 1;
+wait_policy waitPolicy = wait_policy::block;
+bool quiet = false, showStats = false, deferTrace = false;
+trace_buffer *traces = NULL; // producers first, then consumers
+pin_mode pinMode = pin_mode::none;
+cpu_topology *topology = NULL;
 
 void *producer(void *id) {
   int *currentId = (int *)id;
+  trace_buffer *trace = deferTrace ? &traces[*currentId - 1] : NULL;
+  char *items = (char *)malloc(sizeof(char) * batchSize);
+  memset(items, item, batchSize);
 
-  while (1) {
-    sem_wait(&empty);
-    sem_wait(&mutex);
-
-    if (prodCount < iToProd) {
-      buf[inIndex] = item;
-      printf("p:<%d>, item: %c, at %d\n", *currentId, item, inIndex);
-      inIndex = (inIndex + 1) % bSize;
-      prodCount++;
-    } else {
-      sem_post(&mutex);
-      sem_post(&full);
-      return NULL;
+  auto logSlot = [&](char c, int slot) {
+    if (!quiet) {
+      trace_event(trace, 'p', *currentId, c, slot);
     }
-
-    sem_post(&mutex);
-    sem_post(&full);
+  };
+  // Moved-from chars keep their value, so the batch never needs refilling.
+  while (buffer->put_n(items, batchSize, logSlot) > 0) {
   }
+
+  free(items);
+  return NULL;
 }
 
 void *consumer(void *id) {
   int *currentId = (int *)id;
+  trace_buffer *trace = deferTrace ? &traces[nProds + *currentId - 1] : NULL;
+  char *items = (char *)malloc(sizeof(char) * batchSize);
 
-  while (1) {
-    sem_wait(&full);
-    sem_wait(&mutex);
-
-    if (consCount < iToProd) {
-      char tempItem = buf[outIndex];
-      buf[outIndex] = '\0';
-      printf("c:<%d>, item: %c, at %d\n", *currentId, tempItem, outIndex);
-      outIndex = (outIndex + 1) % bSize;
-      consCount++;
-    } else {
-      sem_post(&mutex);
-      sem_post(&empty);
-      return NULL;
+  auto logSlot = [&](char c, int slot) {
+    if (!quiet) {
+      trace_event(trace, 'c', *currentId, c, slot);
     }
-
-    sem_post(&mutex);
-    sem_post(&empty);
+  };
+  while (buffer->get_n(items, batchSize, logSlot) > 0) {
   }
+
+  free(items);
+  return NULL;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s -b <buffer_size> -p <num_producers> -c <num_consumers> -i <items_to_produce> [-k <batch_size>] [-w block|spin|adaptive] [--pin compact|scatter|pair] [-q] [-s] [-t]\n", prog);
+  exit(EXIT_FAILURE);
 }
 
 void initializeResources(int argc, char *argv[]) {
-  if (argc != 9) {
-    fprintf(stderr, "Usage: %s -b <buffer_size> -p <num_producers> -c <num_consumers> -i <items_to_produce>\n", argv[0]);
-    exit(EXIT_FAILURE);
+  int opt;
+  bSize = nProds = nCons = iToProd = -1;
+
+  const struct option longOpts[] = {{"pin", required_argument, NULL, 'P'}, {NULL, 0, NULL, 0}};
+  while ((opt = getopt_long(argc, argv, "b:p:c:i:k:w:qst", longOpts, NULL)) != -1) {
+    switch (opt) {
+      case 'b': bSize = atoi(optarg); break;
+      case 'p': nProds = atoi(optarg); break;
+      case 'c': nCons = atoi(optarg); break;
+      case 'i': iToProd = atoi(optarg); break;
+      case 'k': batchSize = atoi(optarg); break;
+      case 'w':
+        if (!parse_wait_policy(optarg, &waitPolicy)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'q': quiet = true; break;
+      case 's': showStats = true; break;
+      case 't': deferTrace = true; break;
+      case 'P':
+        if (!parse_pin_mode(optarg, &pinMode)) {
+          usage(argv[0]);
+        }
+        break;
+      default: usage(argv[0]);
+    }
   }
 
-  bSize = atoi(argv[2]);
-  nProds = atoi(argv[4]);
-  nCons = atoi(argv[6]);
-  iToProd = atoi(argv[8]);
+  if (bSize < 1 || nProds < 1 || nCons < 1 || iToProd < 0 || batchSize < 1) {
+    usage(argv[0]);
+  }
+  if (batchSize > bSize) {
+    batchSize = bSize;
+  }
 
-  buf = (char *)malloc(sizeof(char) * bSize);
-  sem_init(&mutex, 0, 1);
-  sem_init(&full, 0, 0);
-  sem_init(&empty, 0, bSize);
+  buffer = new bounded_buffer<char>(bSize, iToProd, waitPolicy);
 
   prodThreads = (pthread_t *)malloc(sizeof(pthread_t) * nProds);
   consThreads = (pthread_t *)malloc(sizeof(pthread_t) * nCons);
+  if (deferTrace) {
+    traces = new trace_buffer[nProds + nCons];
+  }
+  if (pinMode != pin_mode::none) {
+    topology = new cpu_topology();
+  }
 }
 
 void cleanupResources() {
-  free(buf);
+  delete buffer;
+  delete topology;
   free(prodThreads);
   free(consThreads);
-  sem_destroy(&mutex);
-  sem_destroy(&empty);
-  sem_destroy(&full);
+  if (traces) {
+    for (int i = 0; i < nProds + nCons; i++) {
+      trace_free(&traces[i]);
+    }
+    delete[] traces;
+  }
 }
 
 int main(int argc, char *argv[]) {
@@ -102,12 +137,22 @@ int main(int argc, char *argv[]) {
   int *prodIds = (int *)malloc(sizeof(int) * nProds);
   int *consIds = (int *)malloc(sizeof(int) * nCons);
 
+  if (topology && showStats) {
+    pin_report(argv[0], *topology, pinMode, nProds, nCons);
+  }
+
+  run_stats stats;
+  stats_start(&stats);
+
   for (int i = 0; i < nProds; i++) {
     prodIds[i] = i + 1;
     if (pthread_create(&prodThreads[i], NULL, producer, &prodIds[i])) {
       fprintf(stderr, "Producer thread %d failed!\n", prodIds[i]);
       exit(EXIT_FAILURE);
     }
+    if (topology && !pin_thread(prodThreads[i], topology->place(pinMode, false, i, nProds))) {
+      fprintf(stderr, "Pinning of producer thread %d failed!\n", prodIds[i]);
+    }
   }
 
   for (int i = 0; i < nCons; i++) {
@@ -116,6 +161,9 @@ int main(int argc, char *argv[]) {
       fprintf(stderr, "Consumer thread %d failed!\n", consIds[i]);
       exit(EXIT_FAILURE);
     }
+    if (topology && !pin_thread(consThreads[i], topology->place(pinMode, true, i, nProds))) {
+      fprintf(stderr, "Pinning of consumer thread %d failed!\n", consIds[i]);
+    }
   }
 
   for (int i = 0; i < nProds; i++) {
@@ -126,6 +174,14 @@ int main(int argc, char *argv[]) {
     pthread_join(consThreads[i], NULL);
   }
 
+  stats_stop(&stats);
+  if (showStats) {
+    stats_report(&stats, argv[0], iToProd, batchSize);
+  }
+  if (deferTrace) {
+    trace_flush(traces, nProds + nCons, stdout);
+  }
+
   free(prodIds);
   free(consIds);
   cleanupResources();
@@ -1,76 +1,282 @@
 // Bryan Duong
 // Nov 3, 2024
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <getopt.h>
 #include <unistd.h>
-#include <semaphore.h>
 
-void *producer(void *id);
-void *consumer(void *id);
+#include <algorithm>
+#include <utility>
+
+#include "bounded_buffer.hpp"
+#include "elastic_buffer.hpp"
+#include "lane_buffer.hpp"
+#include "multicast_ring.hpp"
+#include "payload_pool.hpp"
+#include "sharded_buffer.hpp"
+#include "stats.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
+#include "verify.hpp"
+
 char randAlpha();
 
-pthread_t *prodThreads, *consThreads;
+/// Buffer implementation chosen with -e.
+enum class buffer_engine { ring, sharded, multicast, lanes, elastic };
 
-sem_t mutex, empty, full;
+/// Parses "ring", "sharded", "multicast", "lanes" or "elastic". Returns
+/// false on anything else.
+bool parse_engine(const char *name, buffer_engine *engine) {
+  if (!strcmp(name, "ring")) {
+    *engine = buffer_engine::ring;
+  } else if (!strcmp(name, "sharded")) {
+    *engine = buffer_engine::sharded;
+  } else if (!strcmp(name, "multicast")) {
+    *engine = buffer_engine::multicast;
+  } else if (!strcmp(name, "lanes")) {
+    *engine = buffer_engine::lanes;
+  } else if (!strcmp(name, "elastic")) {
+    *engine = buffer_engine::elastic;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+pthread_t *prodThreads, *consThreads;
 
-char *buf;
 int bufSize, numProds, numCons, iToProd;
-int inIdx = 0, outIdx = 0, prodCount = 0, consCount = 0;
-int totalProduced = 0;
-int done = 0;
+int batchSize = 1;
+wait_policy waitPolicy = wait_policy::block;
+long payloadSize = 0;
+buffer_engine engine = buffer_engine::ring;
+bool byKey = false;
+int maxBufSize = -1;
+int numLanes = 2;
+lane_order laneOrder = lane_order::strict;
+bool quiet = false, showStats = false, deferTrace = false, verify = false;
+trace_buffer *traces = NULL; // producers first, then consumers
+pin_mode pinMode = pin_mode::none;
+cpu_topology *topology = NULL;
+payload_pool *pool = NULL;
+verify_ledger *ledger = NULL; // producers first, then consumers
+
+/// The buffer (or, with -e multicast, -e lanes or -e elastic, the ring, the
+/// lanes or the elastic buffer) shared by the threads moving items of type T.
+template <typename T>
+struct shared {
+  static bounded_buffer<T> *buffer;
+  static multicast_ring<T> *ring;
+  static lane_buffer<T> *lanes;
+  static elastic_buffer<T> *elastic;
+};
+template <typename T>
+bounded_buffer<T> *shared<T>::buffer = NULL;
+template <typename T>
+multicast_ring<T> *shared<T>::ring = NULL;
+template <typename T>
+lane_buffer<T> *shared<T>::lanes = NULL;
+template <typename T>
+elastic_buffer<T> *shared<T>::elastic = NULL;
+
+/// How often the elastic buffer reconsiders its capacity.
+const long ELASTIC_INTERVAL_US = 10000;
+
+/// Largest -b and -g; the elastic buffer rounds capacities up to a power of
+/// two, and 2^30 is the largest that fits an int.
+const int MAX_BUF_SIZE = 1 << 30;
+
+/// Produces a plain letter.
+void makeItem(char &item) {
+  item = randAlpha();
+}
+
+/// Produces a letter stamped into a pooled block; only the handle is queued.
+void makeItem(payload &item) {
+  if (!item.get()) {
+    item = pool->acquire();
+  }
+  item.get()[0] = randAlpha();
+  item.get()[item.size() - 1] = item.get()[0];
+}
+
+/// Stamped items are filled in by stampItem.
+void makeItem(stamped_item &) {
+}
+
+/// Stamps the next item of producer `id`; only stamped items carry a stamp.
+void stampItem(char &, int, unsigned) {
+}
+
+void stampItem(payload &, int, unsigned) {
+}
+
+void stampItem(stamped_item &item, int id, unsigned seq) {
+  item.producer = id;
+  item.seq = seq;
+}
+
+char letterOf(const char &item) {
+  return item;
+}
+
+char letterOf(const payload &item) {
+  return item.get()[0];
+}
+
+char letterOf(const stamped_item &item) {
+  return 'A' + item.seq % 26;
+}
+
+/// Folds an item into the calling thread's tallies (-v); a no-op for items
+/// without a stamp.
+void foldItem(const char &, verify_tally *) {
+}
+
+void foldItem(const payload &, verify_tally *) {
+}
+
+void foldItem(const stamped_item &item, verify_tally *tally) {
+  verify_fold(&tally[item.producer - 1], item.seq);
+}
+
+/// Hands a consumed item back: pooled blocks return to the producers.
+void recycle(char &) {
+}
+
+void recycle(payload &item) {
+  item.reset();
+}
+
+void recycle(stamped_item &) {
+}
 
+template <typename T>
 void *producer(void *id) {
   int *currentId = (int *) id;
-  char alpha;
+  trace_buffer *trace = deferTrace ? &traces[*currentId - 1] : NULL;
+  verify_tally *tally = verify ? &ledger->row(*currentId - 1)[*currentId - 1] : NULL;
+  T *items = new T[batchSize];
+  int ready = 0;
+  unsigned seq = 0;
 
+  auto logSlot = [&](const T &item, int slot) {
+    if (!quiet) {
+      trace_event(trace, 'p', *currentId, letterOf(item), slot);
+    }
+  };
   while (1) {
-    sem_wait(&empty);
-    sem_wait(&mutex);
-
-    if (prodCount < iToProd) {
-      alpha = randAlpha();
-      buf[inIdx] = alpha;
-      printf("p:<%d>, item: %c, at %d\n", *currentId, alpha, inIdx);
-      inIdx = (inIdx + 1) % bufSize;
-      prodCount++;
-      totalProduced++;
-    } else {
-      done = 1;
-      sem_post(&mutex);
-      sem_post(&full);
-      sem_post(&empty);
-      return 0;
+    for (; ready < batchSize; ready++) {
+      makeItem(items[ready]);
+      stampItem(items[ready], *currentId, seq++);
     }
-
-    sem_post(&mutex);
-    sem_post(&full);
+    int count = engine == buffer_engine::multicast ? shared<T>::ring->put_n(items, ready, logSlot)
+                : engine == buffer_engine::lanes   ? shared<T>::lanes->put_n(items, ready, (*currentId - 1) % numLanes, logSlot)
+                : engine == buffer_engine::elastic ? shared<T>::elastic->put_n(items, ready, logSlot)
+                                                   : shared<T>::buffer->put_n(items, ready, logSlot);
+    if (count == 0) {
+      break;
+    }
+    if (tally) {
+      tally->count += count;
+    }
+    // Keep whatever did not fit for the next round.
+    std::move(items + count, items + ready, items);
+    ready -= count;
   }
+
+  delete[] items;
+  return 0;
 }
 
+template <typename T>
 void *consumer(void *id) {
   int *currentCid = (int *) id;
+  trace_buffer *trace = deferTrace ? &traces[numProds + *currentCid - 1] : NULL;
+  verify_tally *tally = verify ? ledger->row(numProds + *currentCid - 1) : NULL;
+  T *items = new T[batchSize];
 
-  while (1) {
-    sem_wait(&full);
-    sem_wait(&mutex);
+  auto logSlot = [&](const T &item, int slot) {
+    if (!quiet) {
+      trace_event(trace, 'c', *currentCid, letterOf(item), slot);
+    }
+  };
+  int count;
+  if (engine == buffer_engine::multicast) {
+    // Items are read in place and stay in the ring for the other consumers.
+    auto readSlot = [&](const T &item, int slot) {
+      logSlot(item, slot);
+      foldItem(item, tally);
+    };
+    while (shared<T>::ring->get_n(*currentCid - 1, batchSize, readSlot) > 0) {
+    }
+  } else if (engine == buffer_engine::lanes) {
+    while ((count = shared<T>::lanes->get_n(items, batchSize, logSlot)) > 0) {
+      for (int i = 0; i < count; i++) {
+        foldItem(items[i], tally);
+        recycle(items[i]);
+      }
+    }
+  } else if (engine == buffer_engine::elastic) {
+    while ((count = shared<T>::elastic->get_n(items, batchSize, logSlot)) > 0) {
+      for (int i = 0; i < count; i++) {
+        foldItem(items[i], tally);
+        recycle(items[i]);
+      }
+    }
+  } else {
+    while ((count = shared<T>::buffer->get_n(items, batchSize, logSlot)) > 0) {
+      for (int i = 0; i < count; i++) {
+        foldItem(items[i], tally);
+        recycle(items[i]);
+      }
+    }
+  }
+
+  delete[] items;
+  return 0;
+}
+
+sharded_buffer<char> *shards = NULL;
 
-    if (consCount < totalProduced) {
-      char tempItem = buf[outIdx];
-      buf[outIdx] = '\0';
-      printf("c:<%d>, item: %c, at %d\n", *currentCid, tempItem, outIdx);
-      outIdx = (outIdx + 1) % bufSize;
-      consCount++;
-    } else if (done) {
-      sem_post(&mutex);
-      sem_post(&full);
-      return 0;
+/// Sharded engine: items go to one consumer's shard, round-robin from the
+/// producer's id or keyed by the letter.
+void *shardedProducer(void *id) {
+  int *currentId = (int *) id;
+  trace_buffer *trace = deferTrace ? &traces[*currentId - 1] : NULL;
+  unsigned next = *currentId - 1;
+
+  auto logShard = [&](char item, int shard) {
+    if (!quiet) {
+      trace_event(trace, 'p', *currentId, item, shard);
+    }
+  };
+  while (1) {
+    char item = randAlpha();
+    if (!shards->put(item, byKey ? (unsigned char)item : next++, logShard)) {
+      break;
     }
+  }
+  return 0;
+}
+
+void *shardedConsumer(void *id) {
+  int *currentCid = (int *) id;
+  trace_buffer *trace = deferTrace ? &traces[numProds + *currentCid - 1] : NULL;
 
-    sem_post(&mutex);
-    sem_post(&empty);
+  auto logShard = [&](char item, int shard) {
+    if (!quiet) {
+      trace_event(trace, 'c', *currentCid, item, shard);
+    }
+  };
+  char item;
+  while (shards->get(item, *currentCid - 1, logShard)) {
   }
+  return 0;
 }
 
 char randAlpha() {
@@ -79,55 +285,302 @@ char randAlpha() {
   return randomLetter;
 }
 
-int main(int argc, char *argv[]) {
-  bufSize = atoi(argv[2]);
-  numProds = atoi(argv[4]);
-  numCons = atoi(argv[6]);
-  iToProd = atoi(argv[8]);
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s -b <buffer_size> -p <num_producers> -c <num_consumers> -i <items_to_produce> [-k <batch_size>] [-w block|spin|adaptive] [-m <payload_bytes>] [-e ring|sharded|multicast|lanes|elastic] [-d rr|key] [-l <lanes>] [-o strict|fair] [-g <max_buffer_size>] [--pin compact|scatter|pair] [-q] [-s] [-t] [-v]\n", prog);
+  exit(EXIT_FAILURE);
+}
 
-  buf = (char *) malloc(sizeof(char) * bufSize);
-  sem_init(&mutex, 0, 1);
-  sem_init(&empty, 0, bufSize);
-  sem_init(&full, 0, 0);
+/// Queueing delay per lane; producer p feeds lane (p - 1) % lanes.
+template <typename T>
+void reportLanes(const char *prog, lane_buffer<T> *lanes) {
+  for (int l = 0; l < lanes->lanes(); l++) {
+    lane_stats st = lanes->stats(l);
+    fprintf(stderr, "%s: lane %d: items %ld, delay mean %llu ns, p99 < %llu ns, max %llu ns\n", prog, l, st.items,
+            (unsigned long long)st.mean, (unsigned long long)st.p99, (unsigned long long)st.max);
+  }
+}
 
-  prodThreads = new pthread_t[numProds];
-  consThreads = new pthread_t[numCons];
+/// Capacity timeline of the elastic buffer.
+template <typename T>
+void reportCapacity(const char *prog, elastic_buffer<T> *buffer) {
+  const std::vector<capacity_change> &changes = buffer->history();
+  for (size_t i = 0; i < changes.size(); i++) {
+    fprintf(stderr, "%s: capacity %d at %.1f ms\n", prog, changes[i].capacity, changes[i].at / 1e6);
+  }
+}
 
-  int *pidList = new int[numProds];
-  int *cidList = new int[numCons];
+/// Runs every producer and consumer thread for items of type T.
+template <typename T>
+int runThreads(int *pidList, int *cidList, const char *argv0) {
+  void *(*produce)(void *) = producer<T>;
+  void *(*consume)(void *) = consumer<T>;
+  if (engine == buffer_engine::sharded) {
+    shards = new sharded_buffer<char>(bufSize, numCons, iToProd, waitPolicy);
+    produce = shardedProducer;
+    consume = shardedConsumer;
+  } else if (engine == buffer_engine::multicast) {
+    shared<T>::ring = new multicast_ring<T>(bufSize, numCons, iToProd);
+  } else if (engine == buffer_engine::lanes) {
+    // Lane i gets 2^(K-1-i) turns per round under -o fair, capped at 2^30 so
+    // the weight still fits an int at -l 32.
+    int weights[lane_buffer<T>::MAX_LANES];
+    for (int i = 0; i < numLanes; i++) {
+      weights[i] = 1 << std::min(numLanes - 1 - i, 30);
+    }
+    shared<T>::lanes = new lane_buffer<T>(numLanes, bufSize, laneOrder, weights, iToProd, waitPolicy);
+  } else if (engine == buffer_engine::elastic) {
+    shared<T>::elastic = new elastic_buffer<T>(bufSize, 1, maxBufSize, ELASTIC_INTERVAL_US, iToProd, waitPolicy);
+  } else {
+    shared<T>::buffer = new bounded_buffer<T>(bufSize, iToProd, waitPolicy);
+  }
 
   for (int i = 0; i < numProds; i++) {
     pidList[i] = i + 1;
-    if (pthread_create(&prodThreads[i], NULL, producer, &pidList[i])) {
+    if (pthread_create(&prodThreads[i], NULL, produce, &pidList[i])) {
       fprintf(stderr, "Creation of producer thread %d failed!\n", pidList[i]);
       return -1;
     }
+    if (topology && !pin_thread(prodThreads[i], topology->place(pinMode, false, i, numProds))) {
+      fprintf(stderr, "Pinning of producer thread %d failed!\n", pidList[i]);
+    }
   }
   for (int i = 0; i < numCons; i++) {
     cidList[i] = i + 1;
-    if (pthread_create(&consThreads[i], NULL, consumer, &cidList[i])) {
+    if (pthread_create(&consThreads[i], NULL, consume, &cidList[i])) {
       fprintf(stderr, "Creation of consumer thread %d failed!\n", cidList[i]);
       return -1;
     }
+    if (topology && !pin_thread(consThreads[i], topology->place(pinMode, true, i, numProds))) {
+      fprintf(stderr, "Pinning of consumer thread %d failed!\n", cidList[i]);
+    }
   }
 
   for (int i = 0; i < numProds; i++) {
     pthread_join(prodThreads[i], NULL);
   }
   for (int i = 0; i < numCons; i++) {
-    sem_post(&full);
     pthread_join(consThreads[i], NULL);
   }
 
-  free(buf);
+  if (engine == buffer_engine::lanes && showStats) {
+    reportLanes(argv0, shared<T>::lanes);
+  }
+  if (engine == buffer_engine::elastic && showStats) {
+    reportCapacity(argv0, shared<T>::elastic);
+  }
+  delete shared<T>::buffer;
+  delete shared<T>::ring;
+  delete shared<T>::lanes;
+  delete shared<T>::elastic;
+  return 0;
+}
+
+/// Compares what each producer put with what the consumers got (-v). Every
+/// consumer of -e multicast must have got every stream on its own; otherwise
+/// the consumers' tallies are added up first. Returns false on a mismatch.
+bool reportVerify(const char *prog) {
+  verify_tally *sent = new verify_tally[numProds];
+  verify_tally *total = new verify_tally[numProds];
+  for (int p = 0; p < numProds; p++) {
+    verify_expect(&sent[p], ledger->row(p)[p].count);
+  }
+  bool multicast = engine == buffer_engine::multicast;
+  int rounds = multicast ? numCons : 1;
+  long items = 0;
+  bool ok = true;
+  for (int r = 0; r < rounds; r++) {
+    ledger->clear(total);
+    for (int c = 0; c < numCons; c++) {
+      if (!multicast || c == r) {
+        for (int p = 0; p < numProds; p++) {
+          verify_merge(&total[p], &ledger->row(numProds + c)[p]);
+        }
+      }
+    }
+    for (int p = 0; p < numProds; p++) {
+      items += sent[p].count;
+      if (!verify_match(&sent[p], &total[p])) {
+        ok = false;
+        char who[32] = "";
+        if (multicast) {
+          snprintf(who, sizeof(who), " to consumer %d", r + 1);
+        }
+        fprintf(stderr, "%s: producer %d%s: sent %ld, received %ld, %ld out of order, checksum %s\n", prog, p + 1,
+                who, sent[p].count, total[p].count, total[p].late,
+                sent[p].sum == total[p].sum && sent[p].xored == total[p].xored ? "ok" : "mismatch");
+      }
+    }
+  }
+  if (ok) {
+    fprintf(stderr, "%s: verified %ld deliveries from %d producers: exactly once, in order\n", prog, items, numProds);
+  }
+  delete[] sent;
+  delete[] total;
+  return ok;
+}
+
+/// Steal rate and how evenly the sharded engine spread the work.
+void reportShards(const char *prog) {
+  long steals = 0, most = 0;
+  for (int i = 0; i < numCons; i++) {
+    steals += shards->steals(i);
+    most = std::max(most, shards->taken(i));
+  }
+  fprintf(stderr, "%s: steals %ld (%.1f%%), busiest consumer %.2fx the mean\n", prog, steals,
+          iToProd ? 100.0 * steals / iToProd : 0.0, iToProd ? (double)most * numCons / iToProd : 0.0);
+  for (int i = 0; i < numCons; i++) {
+    fprintf(stderr, "%s: consumer %d took %ld, stole %ld\n", prog, i + 1, shards->taken(i), shards->steals(i));
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  bufSize = numProds = numCons = iToProd = -1;
+
+  const struct option longOpts[] = {{"pin", required_argument, NULL, 'P'}, {NULL, 0, NULL, 0}};
+  while ((opt = getopt_long(argc, argv, "b:p:c:i:k:w:m:e:d:l:o:g:qstv", longOpts, NULL)) != -1) {
+    switch (opt) {
+      case 'b': bufSize = atoi(optarg); break;
+      case 'p': numProds = atoi(optarg); break;
+      case 'c': numCons = atoi(optarg); break;
+      case 'i': iToProd = atoi(optarg); break;
+      case 'k': batchSize = atoi(optarg); break;
+      case 'w':
+        if (!parse_wait_policy(optarg, &waitPolicy)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'm': payloadSize = atol(optarg); break;
+      case 'e':
+        if (!parse_engine(optarg, &engine)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'l': numLanes = atoi(optarg); break;
+      case 'g': maxBufSize = atoi(optarg); break;
+      case 'o':
+        if (!parse_lane_order(optarg, &laneOrder)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'd':
+        if (!strcmp(optarg, "key")) {
+          byKey = true;
+        } else if (strcmp(optarg, "rr")) {
+          usage(argv[0]);
+        }
+        break;
+      case 'q': quiet = true; break;
+      case 's': showStats = true; break;
+      case 't': deferTrace = true; break;
+      case 'P':
+        if (!parse_pin_mode(optarg, &pinMode)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'v': verify = true; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if (bufSize < 1 || bufSize > MAX_BUF_SIZE || maxBufSize > MAX_BUF_SIZE || numProds < 1 || numCons < 1 || iToProd < 0 || batchSize < 1 || payloadSize < 0 ||
+      numLanes < 1 || numLanes > lane_buffer<char>::MAX_LANES) {
+    usage(argv[0]);
+  }
+  if (engine == buffer_engine::sharded && (payloadSize > 0 || verify)) {
+    fprintf(stderr, "The sharded engine moves plain letters only; drop -m and -v.\n");
+    usage(argv[0]);
+  }
+  if (verify && payloadSize > 0) {
+    fprintf(stderr, "Verification stamps its own items; drop -m.\n");
+    usage(argv[0]);
+  }
+  if (maxBufSize < 0) {
+    maxBufSize = (int)std::min(64LL * bufSize, (long long)MAX_BUF_SIZE);
+  }
+  if (engine == buffer_engine::elastic && maxBufSize < bufSize) {
+    usage(argv[0]);
+  }
+  if (batchSize > bufSize) {
+    batchSize = bufSize;
+  }
+
+  if (payloadSize > 0) {
+    // Enough blocks for a full buffer (every lane of it under -e lanes) plus
+    // every thread's batch in hand, so producers only wait on the pool when
+    // the buffer itself is full.
+    long long blocks = (long long)(engine == buffer_engine::lanes ? numLanes : 1) * bufSize + (long long)(numProds + numCons) * batchSize;
+    if (blocks > INT_MAX) {
+      fprintf(stderr, "The payload pool cannot hold %lld blocks.\n", blocks);
+      return -1;
+    }
+    pool = new payload_pool(payloadSize, (int)blocks);
+    if (!pool->ok()) {
+      fprintf(stderr, "Allocation of the payload pool failed!\n");
+      return -1;
+    }
+  }
+
+  prodThreads = new pthread_t[numProds];
+  consThreads = new pthread_t[numCons];
+
+  int *pidList = new int[numProds];
+  int *cidList = new int[numCons];
+  if (deferTrace) {
+    traces = new trace_buffer[numProds + numCons];
+  }
+  if (verify) {
+    ledger = new verify_ledger(numProds + numCons, numProds);
+    if (!ledger->ok()) {
+      fprintf(stderr, "Allocation of the verification ledger failed!\n");
+      return -1;
+    }
+  }
+
+  if (pinMode != pin_mode::none) {
+    topology = new cpu_topology();
+    if (showStats) {
+      pin_report(argv[0], *topology, pinMode, numProds, numCons);
+    }
+  }
+
+  run_stats stats;
+  stats_start(&stats);
+
+  int ret = verify ? runThreads<stamped_item>(pidList, cidList, argv[0])
+            : pool ? runThreads<payload>(pidList, cidList, argv[0])
+                   : runThreads<char>(pidList, cidList, argv[0]);
+  if (ret) {
+    return ret;
+  }
+
+  stats_stop(&stats);
+  if (showStats) {
+    // Under multicast every consumer gets every item, so count deliveries.
+    stats_report(&stats, argv[0], engine == buffer_engine::multicast ? (long)iToProd * numCons : iToProd, batchSize);
+    if (engine == buffer_engine::sharded) {
+      reportShards(argv[0]);
+    }
+  }
+  if (verify && !reportVerify(argv[0])) {
+    ret = 1;
+  }
+  if (deferTrace) {
+    trace_flush(traces, numProds + numCons, stdout);
+    for (int i = 0; i < numProds + numCons; i++) {
+      trace_free(&traces[i]);
+    }
+    delete[] traces;
+  }
+
+  delete shards;
+  delete pool;
+  delete ledger;
+  delete topology;
   delete[] prodThreads;
   delete[] consThreads;
   delete[] pidList;
   delete[] cidList;
 
-  sem_destroy(&mutex);
-  sem_destroy(&empty);
-  sem_destroy(&full);
-
-  return 0;
+  return ret;
 }
\ No newline at end of file
@@ -0,0 +1,129 @@
+// Cross-process producer/consumer driver.
+//
+// Each subcommand is its own process, so pipeline stages can hand items over
+// through a shared memory segment instead of a socket:
+//
+//   ./shmq create /demo 16 64 2
+//   ./shmq consume /demo 1 & ./shmq consume /demo 2 &
+//   ./shmq produce /demo 1000 1 & ./shmq produce /demo 1000 2
+//   ./shmq destroy /demo
+//
+// Consumers exit once as many producers as create was given (default 1) have
+// sent all their items, or after "shmq close", and the ring is drained. A
+// producer that dies part way does not count; start another in its place.
+// The trace lines match part1/part2 with the slot appended.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shm_buffer.hpp"
+
+char randAlpha() {
+  const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  return alphabet[random() % 52];
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s create <name> <capacity> <slot_bytes> [producers]\n", prog);
+  fprintf(stderr, "       %s produce <name> <items> [id]\n", prog);
+  fprintf(stderr, "       %s consume <name> [id]\n", prog);
+  fprintf(stderr, "       %s close <name>\n", prog);
+  fprintf(stderr, "       %s destroy <name>\n", prog);
+  exit(EXIT_FAILURE);
+}
+
+shm_buffer *attachOrDie(const char *name, shm_role role) {
+  shm_buffer *buffer = shm_buffer::attach(name, role);
+  if (!buffer) {
+    fprintf(stderr, "Attaching to %s failed: %s\n", name, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  return buffer;
+}
+
+int produce(const char *name, int items, int id) {
+  shm_buffer *buffer = attachOrDie(name, shm_role::producer);
+  srandom(getpid());
+
+  int sent = 0;
+  for (; sent < items; sent++) {
+    char item = randAlpha();
+    int slot = buffer->put(&item, 1);
+    if (slot < 0) {
+      break; // closed underneath us
+    }
+    printf("p:<%d>, item: %c, at %d\n", id, item, slot);
+  }
+  fflush(stdout);
+  if (sent == items) {
+    buffer->finish();
+  }
+
+  delete buffer;
+  return sent == items ? 0 : -1;
+}
+
+int consume(const char *name, int id) {
+  shm_buffer *buffer = attachOrDie(name, shm_role::consumer);
+  char *data = new char[buffer->slot_size()];
+  int len, slot;
+
+  while ((slot = buffer->get(data, buffer->slot_size(), &len)) >= 0) {
+    printf("c:<%d>, item: %c, at %d\n", id, len > 0 ? data[0] : '?', slot);
+  }
+  fflush(stdout);
+
+  delete[] data;
+  delete buffer;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    usage(argv[0]);
+  }
+  const char *cmd = argv[1];
+  const char *name = argv[2];
+  // Several processes usually share one terminal or pipe; whole lines only.
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  if (!strcmp(cmd, "create") && (argc == 5 || argc == 6)) {
+    shm_buffer *buffer = shm_buffer::create(name, atoi(argv[3]), atoi(argv[4]), argc == 6 ? atoi(argv[5]) : 1);
+    if (!buffer) {
+      fprintf(stderr, "Creating %s failed: %s\n", name, strerror(errno));
+      return -1;
+    }
+    delete buffer;
+    return 0;
+  }
+  if (!strcmp(cmd, "produce") && (argc == 4 || argc == 5)) {
+    int items = atoi(argv[3]);
+    if (items < 0) {
+      usage(argv[0]);
+    }
+    return produce(name, items, argc == 5 ? atoi(argv[4]) : 1);
+  }
+  if (!strcmp(cmd, "consume") && (argc == 3 || argc == 4)) {
+    return consume(name, argc == 4 ? atoi(argv[3]) : 1);
+  }
+  if (!strcmp(cmd, "close") && argc == 3) {
+    shm_buffer *buffer = attachOrDie(name, shm_role::consumer);
+    int rc = buffer->close();
+    if (rc == -1) {
+      fprintf(stderr, "Closing %s failed: %s\n", name, strerror(errno));
+    }
+    delete buffer;
+    return rc;
+  }
+  if (!strcmp(cmd, "destroy") && argc == 3) {
+    if (shm_buffer::destroy(name) == -1) {
+      fprintf(stderr, "Destroying %s failed: %s\n", name, strerror(errno));
+      return -1;
+    }
+    return 0;
+  }
+  usage(argv[0]);
+}
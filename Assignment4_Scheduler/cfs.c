@@ -0,0 +1,154 @@
+// Bryan Duong
+// Edited date: 2024-11-22
+
+/*
+ * Completely fair scheduling. Each worker's nice level gives it a weight
+ * (nice 0 is 1024, and each step is about 1.25x, as in Linux), and every
+ * quantum it runs adds 1024/weight quanta to its virtual runtime. The next
+ * worker is the one with the least vruntime, so over time each worker's
+ * share of the CPU is its weight over the total.
+ *
+ * Workers in the scheduler sit in a red-black tree keyed by vruntime, the
+ * running one included: pick is the cached leftmost node (O(1)) and a tick
+ * re-keys the running worker (O(log n)). A worker runs for its share of
+ * the target latency, at least the minimum slice, before it is switched.
+ * New workers start at the tree's minimum vruntime, so they neither starve
+ * the others nor wait for them to catch up.
+ *
+ * Options: cfs:latency[/min_slice], in quanta (default cfs:6/1).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "policy.h"
+
+#define NICE_0_WEIGHT	1024
+#define VRUNTIME_SCALE	1024	/* vruntime units per nice-0 quantum */
+
+/* Weight of each nice level, -20..19 (Linux's sched_prio_to_weight) */
+static const int nice_weight[40] = {
+	88761, 71755, 56483, 46273, 36291,
+	29154, 23254, 18705, 14949, 11916,
+	9548, 7620, 6100, 4904, 3906,
+	3121, 2501, 1991, 1586, 1277,
+	1024, 820, 655, 526, 423,
+	335, 272, 215, 172, 137,
+	110, 87, 70, 56, 45,
+	36, 29, 23, 18, 15,
+};
+
+static int latency = 6;
+static int min_slice = 1;
+static rb_tree tree;
+static long total_weight;	/* of the workers in the tree */
+static long min_vruntime;	/* never moves back */
+static pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Per nice level, for the report */
+static int workers_at[40];
+static long quanta_at[40];
+static long turnaround_at[40];	/* nanoseconds */
+
+#define rb_info(node) ((thread_info_t *)((char *)(node) - offsetof(thread_info_t, rb)))
+
+static int weight_of(thread_info_t *info)
+{
+	return nice_weight[info->nice + 20];
+}
+
+static int cfs_setup(const char *args)
+{
+	char *end;
+
+	if (!args)
+		return 1;
+	latency = strtol(args, &end, 10);
+	if (end == args || latency < 1)
+		return 0;
+	if (*end == '/') {
+		args = end + 1;
+		min_slice = strtol(args, &end, 10);
+		if (end == args || min_slice < 1)
+			return 0;
+	}
+	return *end == '\0';
+}
+
+static void cfs_enqueue(thread_info_t *info)
+{
+	pthread_mutex_lock(&tree_lock);
+	info->vruntime = min_vruntime;
+	info->rb.key = info->vruntime;
+	rb_insert(&tree, &info->rb);
+	total_weight += weight_of(info);
+	pthread_mutex_unlock(&tree_lock);
+}
+
+static void cfs_dequeue(thread_info_t *info)
+{
+	pthread_mutex_lock(&tree_lock);
+	rb_erase(&tree, &info->rb);
+	total_weight -= weight_of(info);
+	workers_at[info->nice + 20]++;
+	turnaround_at[info->nice + 20] += info->wait_time + info->run_time;
+	pthread_mutex_unlock(&tree_lock);
+}
+
+static int cfs_tick(thread_info_t *info)
+{
+	int weight = weight_of(info);
+	long slice;
+	rb_node *first;
+
+	pthread_mutex_lock(&tree_lock);
+	quanta_at[info->nice + 20]++;
+
+	/* Charge the quantum and move the worker to its new place */
+	rb_erase(&tree, &info->rb);
+	info->vruntime += (long)VRUNTIME_SCALE * NICE_0_WEIGHT / weight;
+	info->rb.key = info->vruntime;
+	rb_insert(&tree, &info->rb);
+	first = rb_first(&tree);
+	if (first->key > min_vruntime)
+		min_vruntime = first->key;
+
+	/* Its share of the target latency, rounded to whole quanta */
+	slice = (latency * weight + total_weight / 2) / total_weight;
+	if (slice < min_slice)
+		slice = min_slice;
+	pthread_mutex_unlock(&tree_lock);
+
+	if (++info->slice_used < slice)
+		return 1;
+	info->slice_used = 0;
+	return 0;
+}
+
+static thread_info_t *cfs_pick(void)
+{
+	rb_node *first;
+
+	pthread_mutex_lock(&tree_lock);
+	first = rb_first(&tree);
+	pthread_mutex_unlock(&tree_lock);
+	return first ? rb_info(first) : NULL;
+}
+
+static void cfs_report(void)
+{
+	int i;
+
+	printf("CFS: target latency %d quanta, minimum slice %d.\n", latency, min_slice);
+	for (i = 0; i < 40; i++) {
+		if (!workers_at[i])
+			continue;
+		printf("CFS nice %d (weight %d): %d workers ran %ld quanta, average turnaround %f seconds.\n",
+		       i - 20, nice_weight[i], workers_at[i], quanta_at[i],
+		       (double)turnaround_at[i] / 1e9 / workers_at[i]);
+	}
+}
+
+sched_policy_t cfs_policy = { "cfs", cfs_setup, cfs_enqueue, cfs_dequeue, cfs_tick, cfs_pick, cfs_report };
@@ -0,0 +1,454 @@
+// Bryan Duong
+// Edited date: 2024-11-22
+
+/*
+ * Green threads mode (-g K): M:N scheduling in user space. Each worker is a
+ * context with its own small stack instead of a pthread, and K kernel
+ * threads ("carriers") each run round robin over their own queue of them.
+ * Switching is a jump into the carrier's loop and out again. On x86-64 that
+ * is green_switch below, which only swaps callee-saved registers and the
+ * stack pointer, so the kernel is not involved at all; elsewhere it falls
+ * back to swapcontext, which also makes a signal-mask syscall.
+ *
+ * Preemption still comes from the timer signal: every carrier has a timer
+ * aimed at its own thread, whose SIGALRM handler (on the carrier's
+ * alternate stack, so worker stacks stay small) only raises the carrier's
+ * preempt flag. The running worker checks the flag at safe points, counts
+ * one quantum and yields, exactly like the futex mode's preemption points.
+ *
+ * At most queue_size workers hold a stack at once. Admission is shared: a
+ * stack freed by a finished worker goes to an idle carrier if there is one,
+ * and otherwise admits the next worker into its own carrier's queue. A
+ * carrier with nothing to run waits for a stack until the backlog is empty;
+ * contexts never migrate between kernel threads once admitted.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "green.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define GREEN_STACK	(16 * 1024)
+
+#ifdef __x86_64__
+/* A suspended context is just its stack pointer; see green_switch */
+typedef void *green_ctx_t;
+#else
+typedef ucontext_t green_ctx_t;
+#endif
+
+typedef struct carrier carrier_t;
+
+typedef struct green {
+	green_ctx_t	ctx;
+	char		*stack;		/* slot in the stack pool while admitted */
+	carrier_t	*carrier;
+	struct green	*next;		/* run queue link */
+	int		quanta;		/* left to run */
+	int		done;
+	long		mark;		/* ns: when it last started waiting */
+	long		wait_time;	/* ns */
+	long		run_time;
+} green_t;
+
+struct carrier {
+	int			id;
+	pthread_t		thrid;
+	green_ctx_t		ctx;		/* the carrier's scheduling loop */
+	green_t			*head, *tail;
+	green_t			*current;	/* worker it switched to */
+	int			idle;		/* waiting for work (admit_lock) */
+	volatile sig_atomic_t	preempt;	/* set by the timer signal */
+	long			switches;
+	int			finished;
+};
+
+int green_carriers = 0;
+
+static green_t *greens;
+static carrier_t *carriers;
+static int green_count;
+static long quantum;		/* ns */
+static long start;		/* ns, when the run began */
+
+/* Admission: next worker to admit, free stack slots */
+static pthread_mutex_t admit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t room = PTHREAD_COND_INITIALIZER;	/* idle carriers */
+static int next_admit;
+static char *pool;
+static char **free_stacks;
+static int free_count;
+
+static __thread carrier_t *self;	/* the carrier this thread is */
+
+static long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void push_tail(carrier_t *c, green_t *g)
+{
+	g->next = NULL;
+	if (c->tail)
+		c->tail->next = g;
+	else
+		c->head = g;
+	c->tail = g;
+}
+
+static green_t *pop_head(carrier_t *c)
+{
+	green_t *g = c->head;
+
+	if (g && !(c->head = g->next))
+		c->tail = NULL;
+	return g;
+}
+
+static void green_start(void);
+
+#ifdef __x86_64__
+/*
+ * green_switch(from, to): saves the callee-saved registers, MXCSR and the
+ * x87 control word on the current stack, stores the stack pointer in
+ * *from, and restores the same from the stack *to points at. Everything
+ * else is caller-saved, so a plain call suffices and no syscall is made.
+ */
+void green_switch(green_ctx_t *from, green_ctx_t *to);
+__asm__(
+	".text\n"
+	".globl green_switch\n"
+	".type green_switch, @function\n"
+	"green_switch:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq (%rsi), %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size green_switch, .-green_switch\n");
+
+/* Lays out a fresh stack so that switching to ctx enters entry. */
+static void init_context(green_ctx_t *ctx, char *stack, void (*entry)(void))
+{
+	void **sp = (void **)(stack + GREEN_STACK);
+	unsigned int control[2] = { 0, 0 };
+	int i;
+
+	__asm__ volatile("stmxcsr %0\n\tfnstcw %1" : "=m"(control[0]), "=m"(control[1]));
+	*--sp = NULL;			/* entry's return address: never used */
+	*--sp = (void *)entry;		/* where green_switch returns to */
+	for (i = 0; i < 6; i++)
+		*--sp = NULL;		/* rbp, rbx, r12-r15 */
+	sp--;
+	memcpy(sp, control, sizeof(*sp));
+	*ctx = sp;
+}
+#else
+static void green_switch(green_ctx_t *from, green_ctx_t *to)
+{
+	swapcontext(from, to);
+}
+
+static void init_context(green_ctx_t *ctx, char *stack, void (*entry)(void))
+{
+	getcontext(ctx);
+	/* Whoever admits it, the worker must take its carrier's ticks */
+	sigdelset(&ctx->uc_sigmask, SIGALRM);
+	ctx->uc_stack.ss_sp = stack;
+	ctx->uc_stack.ss_size = GREEN_STACK;
+	ctx->uc_link = NULL;
+	makecontext(ctx, entry, 0);
+}
+#endif
+
+/*
+ * The worker itself: meaningless work, with a safe point every 256
+ * iterations where a pending tick costs one quantum and the CPU.
+ */
+static void green_body(green_t *g)
+{
+	float calc = 0.8;
+	unsigned j;
+
+	for (j = 0;; j++) {
+		calc = 4.0 * calc * (1.0 - calc);
+		if ((j & 0xff) == 0 && g->carrier->preempt) {
+			if (--g->quanta <= 0)
+				break;
+			green_switch(&g->ctx, &g->carrier->ctx);
+		}
+	}
+}
+
+/* First code on a worker's stack. It never returns: the stack is reused. */
+static void green_start(void)
+{
+	green_t *g = self->current;
+
+	green_body(g);
+	g->done = 1;
+	green_switch(&g->ctx, &g->carrier->ctx);
+}
+
+/*
+ * Admits the next worker onto c's queue. The caller holds admit_lock and
+ * has checked that there is a next worker and a free stack for it.
+ */
+static void admit_locked(carrier_t *c)
+{
+	green_t *g = &greens[next_admit++];
+
+	/* The carriers still waiting for work will get none */
+	if (next_admit == green_count)
+		pthread_cond_broadcast(&room);
+	g->stack = free_stacks[--free_count];
+	g->carrier = c;
+	init_context(&g->ctx, g->stack, green_start);
+	push_tail(c, g);
+}
+
+/*
+ * Frees a finished worker's stack and admits the next worker with it: onto
+ * a carrier waiting for work if there is one, and otherwise onto c. An idle
+ * carrier's queue is only touched under admit_lock until it wakes.
+ */
+static void release(carrier_t *c, green_t *g)
+{
+	carrier_t *to = c;
+	int i;
+
+	pthread_mutex_lock(&admit_lock);
+	free_stacks[free_count++] = g->stack;
+	if (next_admit < green_count) {
+		for (i = 0; i < green_carriers; i++) {
+			if (carriers[i].idle) {
+				to = &carriers[i];
+				to->idle = 0;
+				pthread_cond_broadcast(&room);
+				break;
+			}
+		}
+		admit_locked(to);
+	}
+	pthread_mutex_unlock(&admit_lock);
+	g->stack = NULL;
+}
+
+/*
+ * Called with c's queue empty: takes a free stack for the next worker, or
+ * waits until another carrier hands it one. Returns NULL once the backlog
+ * is empty.
+ */
+static green_t *wait_for_work(carrier_t *c)
+{
+	pthread_mutex_lock(&admit_lock);
+	c->idle = 1;
+	while (c->idle && next_admit < green_count) {
+		if (free_count) {
+			admit_locked(c);
+			break;
+		}
+		pthread_cond_wait(&room, &admit_lock);
+	}
+	c->idle = 0;
+	pthread_mutex_unlock(&admit_lock);
+	return pop_head(c);
+}
+
+/* SIGALRM: the timer says whose flag to raise. */
+static void tick(int sig, siginfo_t *si, void *uc)
+{
+	((carrier_t *)si->si_value.sival_ptr)->preempt = 1;
+}
+
+static void *carrier_run(void *arg)
+{
+	carrier_t *c = (carrier_t *)arg;
+	struct sigevent sevent;
+	struct itimerspec timerspec;
+	stack_t altstack;
+	sigset_t alarm_set;
+	timer_t timer;
+	green_t *g;
+
+	/* The handler runs on this stack, not on whichever worker it interrupts */
+	altstack.ss_sp = malloc(SIGSTKSZ);
+	altstack.ss_size = SIGSTKSZ;
+	altstack.ss_flags = 0;
+	sigaltstack(&altstack, NULL);
+
+	memset(&sevent, 0, sizeof(sevent));
+	sevent.sigev_notify = SIGEV_THREAD_ID;
+	sevent.sigev_signo = SIGALRM;
+	sevent.sigev_value.sival_ptr = c;
+	sevent.sigev_notify_thread_id = syscall(SYS_gettid);
+	if (timer_create(CLOCK_MONOTONIC, &sevent, &timer) == -1) {
+		perror("timer_create");
+		exit(EXIT_FAILURE);
+	}
+	memset(&timerspec, 0, sizeof(timerspec));
+	timerspec.it_value.tv_sec = quantum / 1000000000L;
+	timerspec.it_value.tv_nsec = quantum % 1000000000L;
+	timerspec.it_interval = timerspec.it_value;
+	timer_settime(timer, 0, &timerspec, NULL);
+
+	sigemptyset(&alarm_set);
+	sigaddset(&alarm_set, SIGALRM);
+	pthread_sigmask(SIG_UNBLOCK, &alarm_set, NULL);
+	self = c;
+
+	while ((g = pop_head(c)) || (g = wait_for_work(c))) {
+		long resumed = now_ns(), stopped;
+
+		g->wait_time += resumed - g->mark;
+		c->preempt = 0;
+		c->current = g;
+		green_switch(&c->ctx, &g->ctx);
+		stopped = now_ns();
+		g->run_time += stopped - resumed;
+		g->mark = stopped;
+		c->switches++;
+
+		if (g->done) {
+			c->finished++;
+			release(c, g);
+		} else {
+			push_tail(c, g);
+		}
+	}
+
+	pthread_sigmask(SIG_BLOCK, &alarm_set, NULL);
+	timer_delete(timer);
+	altstack.ss_flags = SS_DISABLE;
+	sigaltstack(&altstack, NULL);
+	free(altstack.ss_sp);
+	return NULL;
+}
+
+/* switchbench's partner context: hands straight back, forever */
+static green_ctx_t bench_main, bench_partner;
+
+static void bounce(void)
+{
+	for (;;)
+		green_switch(&bench_partner, &bench_main);
+}
+
+double green_switch_ns(long rounds)
+{
+	char *stack = malloc(GREEN_STACK);
+	long i, begin, elapsed;
+
+	init_context(&bench_partner, stack, bounce);
+	begin = now_ns();
+	for (i = 0; i < rounds; i++)
+		green_switch(&bench_main, &bench_partner);
+	elapsed = now_ns() - begin;
+	free(stack);
+	return (double)elapsed / (2 * rounds);
+}
+
+void green_run(int count, int queue_size, const int *quanta, long quantum_ns)
+{
+	struct sigaction sa;
+	sigset_t alarm_set;
+	long wait_times = 0, run_times = 0, switches = 0;
+	int i, slots = queue_size < count ? queue_size : count;
+
+	green_count = count;
+	quantum = quantum_ns;
+	greens = (green_t *)calloc(count, sizeof(green_t));
+	carriers = (carrier_t *)calloc(green_carriers, sizeof(carrier_t));
+
+	/* One reservation for every stack; pages appear as they are touched */
+	pool = mmap(NULL, (size_t)slots * GREEN_STACK, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	free_stacks = (char **)malloc(sizeof(char *) * slots);
+	if (!greens || !carriers || pool == MAP_FAILED || !free_stacks) {
+		perror("green_run");
+		exit(EXIT_FAILURE);
+	}
+	for (i = slots - 1; i >= 0; i--)
+		free_stacks[free_count++] = pool + (size_t)i * GREEN_STACK;
+
+	/* SIGALRM only reaches carriers, which unblock it themselves */
+	sigemptyset(&alarm_set);
+	sigaddset(&alarm_set, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &alarm_set, NULL);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = tick;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+	sigaction(SIGALRM, &sa, NULL);
+
+	start = now_ns();
+	for (i = 0; i < count; i++) {
+		greens[i].quanta = quanta[i];
+		greens[i].mark = start;
+	}
+	/* Fill the queue round robin across carriers */
+	for (i = 0; i < slots; i++)
+		admit_locked(&carriers[i % green_carriers]);
+
+	for (i = 0; i < green_carriers; i++) {
+		carriers[i].id = i;
+		if (pthread_create(&carriers[i].thrid, NULL, carrier_run, &carriers[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < green_carriers; i++)
+		pthread_join(carriers[i].thrid, NULL);
+
+	for (i = 0; i < count; i++) {
+		wait_times += greens[i].wait_time;
+		run_times += greens[i].run_time;
+	}
+	printf("The total wait time is %f seconds.\n", (double)wait_times / 1e9);
+	printf("The total run time is %f seconds.\n", (double)run_times / 1e9);
+	printf("The average wait time is %f seconds.\n", (double)wait_times / 1e9 / count);
+	printf("The average run time is %f seconds.\n", (double)run_times / 1e9 / count);
+	for (i = 0; i < green_carriers; i++) {
+		printf("Carrier %d: finished %d workers in %ld switches.\n", i,
+		       carriers[i].finished, carriers[i].switches);
+		switches += carriers[i].switches;
+	}
+	printf("Green: %ld switches in %f seconds.\n", switches, (double)(now_ns() - start) / 1e9);
+
+	munmap(pool, (size_t)slots * GREEN_STACK);
+	free(free_stacks);
+	free(carriers);
+	free(greens);
+}
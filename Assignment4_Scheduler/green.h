@@ -0,0 +1,16 @@
+#ifndef __GREEN_H_
+#define __GREEN_H_
+
+extern int green_carriers;	/* kernel threads for -g; 0 runs workers as pthreads */
+
+/*
+ * Runs the workers as user-level contexts multiplexed on green_carriers
+ * kernel threads, at most queue_size at a time, each for its quanta of
+ * quantum_ns, and prints the usual wait/run summary.
+ */
+void green_run(int count, int queue_size, const int *quanta, long quantum_ns);
+
+/* Mean cost in ns of one switch between two green contexts (switchbench). */
+double green_switch_ns(long rounds);
+
+#endif /* __GREEN_H_ */
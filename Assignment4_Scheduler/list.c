@@ -2,19 +2,51 @@
  
 #include "list.h"
 
+/* Unlinks an element; the caller holds the lock. */
+static void unlink_elem(thread_info_list *list, list_elem *old)
+{
+	if (old->next) {
+		old->next->prev = old->prev;
+	}
+	if (old->prev) {
+		old->prev->next = old->next;
+	}
+	if (list->tail == old) {
+		list->tail = old->prev;
+	}
+	if (list->head == old) {
+		list->head = old->next;
+	}
+
+	old->next = old->prev = 0;
+	list->size--;
+}
+
+/* Links an element at the tail; the caller holds the lock. */
+static void link_tail(thread_info_list *list, list_elem *new)
+{
+	new->prev = list->tail;
+	new->next = 0;
+
+	if (new->prev) {
+		new->prev->next = new;
+	}
+	list->tail = new;
+	if (list->head == 0) {
+		list->head = new;
+	}
+	list->size++;
+}
+
 /* list helper functions */
 int list_size(thread_info_list *list)
 {
-	int cnt = 0;
+	int cnt;
 
 	if (!list) return -1;
 
 	pthread_mutex_lock(&list->lock);
-	list_elem *le = list->head;
-	while (le) {
-		cnt++;
-		le = le->next;
-	}
+	cnt = list->size;
 	pthread_mutex_unlock(&list->lock);
 
 	return cnt;
@@ -34,6 +66,8 @@ int list_insert_head(thread_info_list *list, list_elem *new)
 	if (list->tail == 0) {
 		list->tail = new;
 	}
+	list->size++;
+	pthread_cond_broadcast(&list->nonempty);
 	pthread_mutex_unlock(&list->lock);
 	return 0;
 }
@@ -43,16 +77,8 @@ int list_insert_tail(thread_info_list *list, list_elem *new)
 	if (!list || !new) return -1;
 
 	pthread_mutex_lock(&list->lock);
-	new->prev = list->tail;
-	new->next = 0;
-
-	if (new->prev) {
-		new->prev->next = new;
-	}
-	list->tail = new;
-	if (list->head == 0) {
-		list->head = new;
-	}
+	link_tail(list, new);
+	pthread_cond_broadcast(&list->nonempty);
 	pthread_mutex_unlock(&list->lock);
 
 	return 0;
@@ -63,25 +89,60 @@ int list_remove(thread_info_list *list, list_elem *old)
 	if (!old || !list) return -1;
 
 	pthread_mutex_lock(&list->lock);
-	if (old->next) {
-		old->next->prev = old->prev;
-	}
-	if (old->prev) {
-		old->prev->next = old->next;
-	}
-	if (list->tail == old) {
-		list->tail = old->prev;
-	}
-	if (list->head == old) {
-		list->head = old->next;
+	unlink_elem(list, old);
+	pthread_mutex_unlock(&list->lock);
+
+	return 0;
+}
+
+int list_move_tail(thread_info_list *list, list_elem *elem)
+{
+	if (!list || !elem) return -1;
+
+	pthread_mutex_lock(&list->lock);
+	if (list->tail != elem) {
+		unlink_elem(list, elem);
+		link_tail(list, elem);
 	}
+	pthread_mutex_unlock(&list->lock);
 
-	old->next = old->prev = 0;
+	return 0;
+}
+
+int list_splice_tail(thread_info_list *list, thread_info_list *from)
+{
+	if (!list || !from || list == from) return -1;
+
+	pthread_mutex_lock(&list->lock);
+	pthread_mutex_lock(&from->lock);
+	if (from->head) {
+		from->head->prev = list->tail;
+		if (list->tail) {
+			list->tail->next = from->head;
+		} else {
+			list->head = from->head;
+		}
+		list->tail = from->tail;
+		list->size += from->size;
+		from->head = from->tail = 0;
+		from->size = 0;
+		pthread_cond_broadcast(&list->nonempty);
+	}
+	pthread_mutex_unlock(&from->lock);
 	pthread_mutex_unlock(&list->lock);
 
 	return 0;
 }
 
+void list_wait_nonempty(thread_info_list *list)
+{
+	pthread_mutex_lock(&list->lock);
+	while (!list->head) {
+		pthread_cond_wait(&list->nonempty, &list->lock);
+	}
+	pthread_mutex_unlock(&list->lock);
+}
+
 void print_list(thread_info_list *list)
 {
 	pthread_mutex_lock(&list->lock);
@@ -9,12 +9,18 @@ typedef struct list_elem {
 	void			*info;
 } list_elem;
 
+/*
+ * Elements are embedded in what they list (see thread_info_t), so the list
+ * never allocates. Inserts, removals, moves and splices are O(1).
+ */
 typedef struct thread_info_list {
 	list_elem	*head;
 	list_elem	*tail;
+	int		size;
 	pthread_mutex_t	lock;
+	pthread_cond_t	nonempty;	/* broadcast on every insert */
 } thread_info_list;
-/* Compute the size of a list (O(n) time). */
+/* Return the size of a list. */
 int list_size(thread_info_list *list);
 /* Insert an element at the head of a list.*/
 int list_insert_head(thread_info_list *list, list_elem *new);
@@ -22,6 +28,12 @@ int list_insert_head(thread_info_list *list, list_elem *new);
 int list_insert_tail(thread_info_list *list, list_elem *new);
 /* Removes an element from a list (assuming it's in the list). */
 int list_remove(thread_info_list *list, list_elem *new);
+/* Moves an element already in the list to its tail. */
+int list_move_tail(thread_info_list *list, list_elem *elem);
+/* Moves every element of from to the tail of list, keeping their order. */
+int list_splice_tail(thread_info_list *list, thread_info_list *from);
+/* Block until the list has at least one element. */
+void list_wait_nonempty(thread_info_list *list);
 void print_list(thread_info_list *list);
 #endif /* __LIST_H_ */
 
@@ -0,0 +1,180 @@
+// Bryan Duong
+// Edited date: 2024-11-22
+
+/*
+ * Multi-level feedback queue. Workers start at level 0. A worker that uses
+ * its level's whole slice drops a level, and one that is still in its slice
+ * is preempted only when a worker at a higher level is waiting. Every
+ * `boost` quanta all workers go back to level 0, so long jobs never starve.
+ * Within a level it is round robin: each level keeps its own FIFO queue, a
+ * worker that gives up the CPU goes to the tail of its level's queue, and
+ * pick takes the head of the highest nonempty level, found from a bitmap.
+ * A boost splices the lower levels onto level 0 in level order, so every
+ * operation is O(1) in the number of workers.
+ *
+ * Options: mlfq:s0,s1,...[/boost], slices in quanta (default mlfq:1,2,4/20).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "policy.h"
+
+#define MAX_LEVELS 8
+
+static int levels = 3;
+static int slice[MAX_LEVELS] = { 1, 2, 4 };
+static long boost = 20;
+static long ticks;			/* quanta run so far */
+static unsigned epoch;			/* bumped by every boost */
+static long residency[MAX_LEVELS];	/* quanta run at each level */
+static thread_info_list queue[MAX_LEVELS];
+static unsigned nonempty;		/* bit l set while queue[l] holds workers */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A worker's level, after any boost it has missed. */
+static int level_of(thread_info_t *info)
+{
+	if (info->epoch != epoch) {
+		info->epoch = epoch;
+		info->level = 0;
+		info->slice_used = 0;
+	}
+	return info->level;
+}
+
+/* Moves a worker to the tail of queue[to]; the caller holds queue_lock. */
+static void requeue(thread_info_t *info, int from, int to)
+{
+	if (from == to) {
+		list_move_tail(&queue[to], &info->lvl_le);
+		return;
+	}
+	list_remove(&queue[from], &info->lvl_le);
+	if (!queue[from].head)
+		nonempty &= ~(1u << from);
+	list_insert_tail(&queue[to], &info->lvl_le);
+	nonempty |= 1u << to;
+}
+
+/* Sends every worker back to level 0; the caller holds queue_lock. */
+static void boost_all(void)
+{
+	int i;
+
+	epoch++;
+	for (i = 1; i < levels; i++)
+		list_splice_tail(&queue[0], &queue[i]);
+	if (nonempty)
+		nonempty = 1;
+}
+
+static int mlfq_setup(const char *args)
+{
+	const char *p = args;
+	char *end;
+	int i;
+
+	for (i = 0; i < MAX_LEVELS; i++) {
+		pthread_mutex_init(&queue[i].lock, NULL);
+		pthread_cond_init(&queue[i].nonempty, NULL);
+	}
+	if (!args)
+		return 1;
+	for (levels = 0; levels < MAX_LEVELS; levels++) {
+		slice[levels] = strtol(p, &end, 10);
+		if (end == p || slice[levels] < 1)
+			return 0;
+		p = end;
+		if (*p != ',')
+			break;
+		p++;
+	}
+	if (levels++ == MAX_LEVELS)
+		return 0;
+	if (*p == '/') {
+		boost = strtol(p + 1, &end, 10);
+		if (end == p + 1 || boost < 1)
+			return 0;
+		p = end;
+	}
+	return *p == '\0';
+}
+
+static void mlfq_enqueue(thread_info_t *info)
+{
+	pthread_mutex_lock(&queue_lock);
+	info->epoch = epoch;
+	info->level = 0;
+	info->slice_used = 0;
+	info->lvl_le.info = info;
+	list_insert_tail(&queue[0], &info->lvl_le);
+	nonempty |= 1;
+	pthread_mutex_unlock(&queue_lock);
+}
+
+static void mlfq_dequeue(thread_info_t *info)
+{
+	int lvl;
+
+	pthread_mutex_lock(&queue_lock);
+	lvl = level_of(info);
+	list_remove(&queue[lvl], &info->lvl_le);
+	if (!queue[lvl].head)
+		nonempty &= ~(1u << lvl);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+static int mlfq_tick(thread_info_t *info)
+{
+	int lvl, keep;
+
+	pthread_mutex_lock(&queue_lock);
+	if (++ticks % boost == 0)
+		boost_all();
+	lvl = level_of(info);
+	residency[lvl]++;
+
+	if (++info->slice_used >= slice[lvl]) {
+		/* Used the whole slice: demote and give up the CPU */
+		info->slice_used = 0;
+		if (lvl < levels - 1)
+			info->level++;
+		keep = 0;
+	} else {
+		/* Still in its slice: keep running unless a higher level waits */
+		keep = __builtin_ctz(nonempty) >= lvl;
+	}
+	if (!keep)
+		requeue(info, lvl, info->level);
+	pthread_mutex_unlock(&queue_lock);
+
+	return keep;
+}
+
+static thread_info_t *mlfq_pick(void)
+{
+	thread_info_t *info = NULL;
+
+	pthread_mutex_lock(&queue_lock);
+	if (nonempty)
+		info = queue[__builtin_ctz(nonempty)].head->info;
+	pthread_mutex_unlock(&queue_lock);
+	return info;
+}
+
+static void mlfq_report(void)
+{
+	long total = 0;
+	int i;
+
+	for (i = 0; i < levels; i++)
+		total += residency[i];
+	printf("MLFQ: %d levels, boost every %ld quanta.\n", levels, boost);
+	for (i = 0; i < levels; i++)
+		printf("MLFQ level %d: slice %d, ran %ld quanta (%.1f%%).\n", i, slice[i],
+		       residency[i], total ? 100.0 * residency[i] / total : 0.0);
+}
+
+sched_policy_t mlfq_policy = { "mlfq", mlfq_setup, mlfq_enqueue, mlfq_dequeue, mlfq_tick, mlfq_pick, mlfq_report };
@@ -0,0 +1,29 @@
+#ifndef __PARK_H_
+#define __PARK_H_
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Park/unpark on a futex word that counts turns. unpark() bumps the word
+ * and wakes one sleeper; park_until_turn() sleeps while the word still
+ * holds the last turn the caller took, so a wake that comes first is
+ * never lost and no signal is involved.
+ */
+static inline void park_until_turn(int *turn, int *seen)
+{
+	int now;
+
+	while ((now = __atomic_load_n(turn, __ATOMIC_ACQUIRE)) == *seen)
+		syscall(SYS_futex, turn, FUTEX_WAIT_PRIVATE, now, NULL, NULL, 0);
+	*seen = now;
+}
+
+static inline void unpark(int *turn)
+{
+	__atomic_add_fetch(turn, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, turn, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+#endif /* __PARK_H_ */
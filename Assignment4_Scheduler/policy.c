@@ -0,0 +1,43 @@
+// Bryan Duong
+// Edited date: 2024-11-22
+
+#include <stdio.h>
+#include <string.h>
+
+#include "policy.h"
+
+/*
+ * Round robin: every worker gets one quantum and goes to the back of the
+ * queue, so the next worker is always the head.
+ */
+static int rr_tick(thread_info_t *info)
+{
+	return 0;
+}
+
+static thread_info_t *rr_pick(void)
+{
+	return sched_queue.head ? sched_queue.head->info : NULL;
+}
+
+sched_policy_t rr_policy = { "rr", NULL, NULL, NULL, rr_tick, rr_pick, NULL };
+
+static sched_policy_t *policies[] = { &rr_policy, &mlfq_policy, &cfs_policy, &srtf_policy, &stride_policy };
+
+sched_policy_t *find_policy(const char *spec)
+{
+	const char *args = strchr(spec, ':');
+	size_t len = args ? (size_t)(args - spec) : strlen(spec);
+	size_t i;
+
+	for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+		sched_policy_t *p = policies[i];
+
+		if (strlen(p->name) != len || strncmp(p->name, spec, len))
+			continue;
+		if (p->setup)
+			return p->setup(args ? args + 1 : NULL) ? p : NULL;
+		return args ? NULL : p;
+	}
+	return NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef __POLICY_H_
+#define __POLICY_H_
+
+#include "scheduler.h"
+
+/*
+ * A scheduling policy (-p). The scheduler calls tick() once per quantum for
+ * the worker that ran it; a nonzero return lets that worker run on for
+ * another quantum without a switch. Otherwise the worker is suspended, moved
+ * to the tail of sched_queue, and pick() chooses who runs next from the
+ * workers in sched_queue. Policies that keep their own run queue are told
+ * when a worker joins and leaves. enqueue() runs on the worker's thread
+ * just after it is inserted into sched_queue, both under pick_lock, so a
+ * pick never sees a worker that is in one but not the other. dequeue() runs
+ * on the scheduler thread just before the worker is unlinked from
+ * sched_queue.
+ */
+typedef struct sched_policy {
+	const char	*name;
+	int		(*setup)(const char *args);	/* text after "name:", or NULL; 0 if invalid */
+	void		(*enqueue)(thread_info_t *info);	/* or NULL */
+	void		(*dequeue)(thread_info_t *info);	/* or NULL */
+	int		(*tick)(thread_info_t *info);
+	thread_info_t	*(*pick)(void);
+	void		(*report)(void);		/* extra summary lines, or NULL */
+} sched_policy_t;
+
+extern sched_policy_t rr_policy;
+extern sched_policy_t mlfq_policy;
+extern sched_policy_t cfs_policy;
+extern sched_policy_t srtf_policy;
+extern sched_policy_t stride_policy;
+
+extern sched_policy_t *current_policy;	/* chosen with -p */
+
+/* Looks up "name" or "name:args" and runs its setup; NULL if either fails. */
+sched_policy_t *find_policy(const char *spec);
+
+#endif /* __POLICY_H_ */
@@ -0,0 +1,242 @@
+// Bryan Duong
+// Edited date: 2024-11-22
+
+#include <stddef.h>
+
+#include "rbtree.h"
+
+static void rotate_left(rb_tree *tree, rb_node *x)
+{
+	rb_node *y = x->right;
+
+	x->right = y->left;
+	if (y->left)
+		y->left->parent = x;
+	y->parent = x->parent;
+	if (!x->parent)
+		tree->root = y;
+	else if (x == x->parent->left)
+		x->parent->left = y;
+	else
+		x->parent->right = y;
+	y->left = x;
+	x->parent = y;
+}
+
+static void rotate_right(rb_tree *tree, rb_node *x)
+{
+	rb_node *y = x->left;
+
+	x->left = y->right;
+	if (y->right)
+		y->right->parent = x;
+	y->parent = x->parent;
+	if (!x->parent)
+		tree->root = y;
+	else if (x == x->parent->right)
+		x->parent->right = y;
+	else
+		x->parent->left = y;
+	y->right = x;
+	x->parent = y;
+}
+
+/* Puts v where u was in u's parent. */
+static void transplant(rb_tree *tree, rb_node *u, rb_node *v)
+{
+	if (!u->parent)
+		tree->root = v;
+	else if (u == u->parent->left)
+		u->parent->left = v;
+	else
+		u->parent->right = v;
+	if (v)
+		v->parent = u->parent;
+}
+
+static int is_red(rb_node *node)
+{
+	return node && node->red;
+}
+
+void rb_insert(rb_tree *tree, rb_node *node)
+{
+	rb_node **link = &tree->root, *parent = NULL;
+	int smallest = 1;
+
+	while (*link) {
+		parent = *link;
+		if (node->key < parent->key) {
+			link = &parent->left;
+		} else {
+			link = &parent->right;
+			smallest = 0;
+		}
+	}
+	node->parent = parent;
+	node->left = node->right = NULL;
+	node->red = 1;
+	*link = node;
+	if (smallest)
+		tree->first = node;
+	tree->size++;
+
+	/* Fix a red node under a red parent, walking up */
+	while (is_red(node->parent)) {
+		rb_node *p = node->parent, *g = p->parent;
+
+		if (p == g->left) {
+			rb_node *u = g->right;
+
+			if (is_red(u)) {
+				p->red = u->red = 0;
+				g->red = 1;
+				node = g;
+				continue;
+			}
+			if (node == p->right) {
+				rotate_left(tree, p);
+				p = node;
+			}
+			p->red = 0;
+			g->red = 1;
+			rotate_right(tree, g);
+			break;
+		} else {
+			rb_node *u = g->left;
+
+			if (is_red(u)) {
+				p->red = u->red = 0;
+				g->red = 1;
+				node = g;
+				continue;
+			}
+			if (node == p->left) {
+				rotate_right(tree, p);
+				p = node;
+			}
+			p->red = 0;
+			g->red = 1;
+			rotate_left(tree, g);
+			break;
+		}
+	}
+	tree->root->red = 0;
+}
+
+void rb_erase(rb_tree *tree, rb_node *node)
+{
+	rb_node *y = node, *x, *xp;
+	int removed_red = node->red;
+
+	if (tree->first == node)
+		tree->first = rb_next(node);
+
+	if (!node->left) {
+		x = node->right;
+		xp = node->parent;
+		transplant(tree, node, node->right);
+	} else if (!node->right) {
+		x = node->left;
+		xp = node->parent;
+		transplant(tree, node, node->left);
+	} else {
+		/* Replace node with its successor y */
+		y = node->right;
+		while (y->left)
+			y = y->left;
+		removed_red = y->red;
+		x = y->right;
+		if (y->parent == node) {
+			xp = y;
+		} else {
+			xp = y->parent;
+			transplant(tree, y, y->right);
+			y->right = node->right;
+			y->right->parent = y;
+		}
+		transplant(tree, node, y);
+		y->left = node->left;
+		y->left->parent = y;
+		y->red = node->red;
+	}
+	tree->size--;
+	if (removed_red)
+		return;
+
+	/* x (possibly NULL, under xp) is short one black node */
+	while (x != tree->root && !is_red(x)) {
+		if (x == xp->left) {
+			rb_node *w = xp->right;
+
+			if (is_red(w)) {
+				w->red = 0;
+				xp->red = 1;
+				rotate_left(tree, xp);
+				w = xp->right;
+			}
+			if (!is_red(w->left) && !is_red(w->right)) {
+				w->red = 1;
+				x = xp;
+				xp = x->parent;
+				continue;
+			}
+			if (!is_red(w->right)) {
+				w->left->red = 0;
+				w->red = 1;
+				rotate_right(tree, w);
+				w = xp->right;
+			}
+			w->red = xp->red;
+			xp->red = 0;
+			w->right->red = 0;
+			rotate_left(tree, xp);
+		} else {
+			rb_node *w = xp->left;
+
+			if (is_red(w)) {
+				w->red = 0;
+				xp->red = 1;
+				rotate_right(tree, xp);
+				w = xp->left;
+			}
+			if (!is_red(w->left) && !is_red(w->right)) {
+				w->red = 1;
+				x = xp;
+				xp = x->parent;
+				continue;
+			}
+			if (!is_red(w->left)) {
+				w->right->red = 0;
+				w->red = 1;
+				rotate_left(tree, w);
+				w = xp->left;
+			}
+			w->red = xp->red;
+			xp->red = 0;
+			w->left->red = 0;
+			rotate_right(tree, xp);
+		}
+		x = tree->root;
+	}
+	if (x)
+		x->red = 0;
+}
+
+rb_node *rb_first(rb_tree *tree)
+{
+	return tree->first;
+}
+
+rb_node *rb_next(rb_node *node)
+{
+	if (node->right) {
+		node = node->right;
+		while (node->left)
+			node = node->left;
+		return node;
+	}
+	while (node->parent && node == node->parent->right)
+		node = node->parent;
+	return node->parent;
+}
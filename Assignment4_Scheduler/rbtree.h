@@ -0,0 +1,33 @@
+#ifndef __RBTREE_H_
+#define __RBTREE_H_
+
+/*
+ * Intrusive red-black tree ordered by a long key. Nodes are embedded in
+ * what they order (see thread_info_t), so the tree never allocates. Equal
+ * keys keep insertion order. Insert and erase are O(log n); the smallest
+ * node is cached, so rb_first is O(1). No locking: callers serialize.
+ */
+typedef struct rb_node {
+	struct rb_node	*parent;
+	struct rb_node	*left;
+	struct rb_node	*right;
+	int		red;
+	long		key;
+} rb_node;
+
+typedef struct rb_tree {
+	rb_node		*root;
+	rb_node		*first;		/* smallest key */
+	int		size;
+} rb_tree;
+
+/* Inserts a node; set node->key first. */
+void rb_insert(rb_tree *tree, rb_node *node);
+/* Removes a node that is in the tree. */
+void rb_erase(rb_tree *tree, rb_node *node);
+/* Returns the node with the smallest key, or NULL if the tree is empty. */
+rb_node *rb_first(rb_tree *tree);
+/* Returns the node after node in key order, or NULL. */
+rb_node *rb_next(rb_node *node);
+
+#endif /* __RBTREE_H_ */
@@ -13,16 +13,21 @@
 
 #include "scheduler.h"
 #include "worker.h"
+#include "park.h"
+#include "policy.h"
+#include "smp.h"
+#include "green.h"
 
 /*
  * Define the extern global variables here.
  */
 
-#define CLOCK CLOCK_REALTIME  // Calendar time as a value of time_t
-#define QUANTUM 1             // Define quantum time in seconds
+#define CLOCK CLOCK_MONOTONIC  // Steady clock: unaffected by changes to the calendar time
 
 sem_t queue_sem;            /* semaphore for scheduler queue */
 thread_info_list sched_queue; /* list of current workers */
+pthread_mutex_t pick_lock = PTHREAD_MUTEX_INITIALIZER; /* see scheduler.h */
+switch_mode_t switch_mode = SWITCH_FUTEX; /* set with -m */
 
 static int quit = 0;
 static timer_t timer;
@@ -31,12 +36,20 @@ static long wait_times = 0;
 static long run_times = 0;
 static int completed = 0;
 static int thread_count = 0;
+static long quantum_ns = QUANTUM_NS; /* set with -q */
+static long response_times = 0;
+sched_policy_t *current_policy = &rr_policy; /* set with -p */
+static int policy_chosen = 0; /* -p given: report response time too */
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER; /* for -c, several CPUs cancel */
 
 // Structure to specify when a timer expires
 struct itimerspec timerspec;
 
 // Structures to change the action taken by a process on receipt of a specific signal
-struct sigaction saction1, saction2, saction3;
+struct sigaction saction2, saction3;
+
+// SIGALRM only: blocked in every thread and taken synchronously by the scheduler
+static sigset_t alarm_set;
 
 // Structure for notification from asynchronous routines
 struct sigevent sevent;
@@ -64,6 +77,9 @@ void update_wait_time(thread_info_t *info) {
     clock_gettime(CLOCK, &now);
     info->wait_time += time_difference(&now, &info->suspend_time);
     info->resume_time = now; 
+    /* The first resume follows creation, which set suspend_time */
+    if (info->response_time < 0)
+        info->response_time = info->wait_time;
 }
 
 static void init_sched_queue(int queue_size) {
@@ -84,19 +100,36 @@ static void init_sched_queue(int queue_size) {
 
     /* Initialize the scheduler queue */
     sched_queue.head = sched_queue.tail = NULL;
+    sched_queue.size = 0;
     pthread_mutex_init(&sched_queue.lock, NULL);
+    pthread_cond_init(&sched_queue.nonempty, NULL);
 }
 
 /*
  * Signal a worker thread that it can resume.
  */
-static void resume_worker(thread_info_t *info) {
+void resume_worker(thread_info_t *info) {
     printf("Scheduler: resuming %lu.\n", info->thrid);
 
     /*
      * Signal the worker thread that it can resume
      */
-    pthread_kill(info->thrid, SIGUSR2);
+    if (switch_mode == SWITCH_SIGNAL) {
+        pthread_kill(info->thrid, SIGUSR2);
+    } else {
+        /*
+         * Only a parked worker gets a turn; a park it has not reached yet
+         * is just withdrawn, so no turn is left over for a later park.
+         */
+        int state = PREEMPT_PARK;
+
+        if (!__atomic_compare_exchange_n(&info->preempt, &state, PREEMPT_NONE, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+            state == PREEMPT_PARKED &&
+            __atomic_compare_exchange_n(&info->preempt, &state, PREEMPT_NONE, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            unpark(&info->turn);
+    }
 
     /* Update the wait time for the thread */
     update_wait_time(info);
@@ -104,30 +137,49 @@ static void resume_worker(thread_info_t *info) {
 
 /* Send a signal to the thread, telling it to kill itself */
 void cancel_worker(thread_info_t *info) {
+    int done;
+
     /* Send a signal to the thread, telling it to kill itself */
-    pthread_kill(info->thrid, SIGTERM);
+    if (switch_mode == SWITCH_SIGNAL)
+        pthread_kill(info->thrid, SIGTERM);
 
     /* Update global wait and run time info */
+    pthread_mutex_lock(&totals_lock);
     wait_times += info->wait_time;
     run_times += info->run_time;
-    completed++;
+    response_times += info->response_time;
+    done = ++completed >= thread_count;
+    pthread_mutex_unlock(&totals_lock);
 
     /* Update schedule queue */
     leave_scheduler_queue(info);
 
-    if (completed >= thread_count) {
+    /*
+     * A futex-switched worker exits at its next safe point, or as soon as it
+     * is woken if it is parked, and from then on owns and frees info.
+     */
+    if (switch_mode == SWITCH_FUTEX &&
+        __atomic_exchange_n(&info->preempt, PREEMPT_EXIT, __ATOMIC_ACQ_REL) == PREEMPT_PARKED)
+        unpark(&info->turn);
+
+    if (done) {
         sched_yield(); /* Let other threads terminate */
-        printf("The total wait time is %f seconds.\n", (float)wait_times / 1000000);
-        printf("The total run time is %f seconds.\n", (float)run_times / 1000000);
-        printf("The average wait time is %f seconds.\n", (float)wait_times / 1000000 / thread_count);
-        printf("The average run time is %f seconds.\n", (float)run_times / 1000000 / thread_count);
+        printf("The total wait time is %f seconds.\n", (double)wait_times / 1e9);
+        printf("The total run time is %f seconds.\n", (double)run_times / 1e9);
+        printf("The average wait time is %f seconds.\n", (double)wait_times / 1e9 / thread_count);
+        printf("The average run time is %f seconds.\n", (double)run_times / 1e9 / thread_count);
+        if (policy_chosen) {
+            printf("The average response time is %f seconds.\n", (double)response_times / 1e9 / thread_count);
+            if (current_policy->report)
+                current_policy->report();
+        }
     }
 }
 
 /*
  * Signals a worker thread that it should suspend.
  */
-static void suspend_worker(thread_info_t *info) {
+void suspend_worker(thread_info_t *info) {
     printf("Scheduler: suspending %lu.\n", info->thrid);
 
     /* Update the run time for the thread */
@@ -142,22 +194,38 @@ static void suspend_worker(thread_info_t *info) {
          * Thread still running: suspend.
          * Signal the worker thread that it should suspend.
          */
-        pthread_kill(info->thrid, SIGUSR1);
+        if (switch_mode == SWITCH_SIGNAL)
+            pthread_kill(info->thrid, SIGUSR1);
+        else
+            __atomic_store_n(&info->preempt, PREEMPT_PARK, __ATOMIC_RELEASE);
 
         /* Update Schedule queue */
-        list_remove(&sched_queue, info->le);
-        list_insert_tail(&sched_queue, info->le);
+        list_move_tail(&sched_queue, &info->le);
     } else {
         /* Thread done: cancel */
         cancel_worker(info);
     }
 }
 
+/*
+ * Whether every worker has been cancelled.
+ */
+int workers_finished() {
+    int done;
+
+    pthread_mutex_lock(&totals_lock);
+    done = completed >= thread_count;
+    pthread_mutex_unlock(&totals_lock);
+    return done;
+}
+
 /*
  * This is the scheduling algorithm
  * Pick the next worker thread from the available list
  */
 static thread_info_t *next_worker() {
+    thread_info_t *info;
+
     if (completed >= thread_count)
         return NULL;
 
@@ -165,9 +233,16 @@ static thread_info_t *next_worker() {
     printf("Scheduler: scheduling.\n");
 
     /* Return the thread_info_t for the next thread to run */
-    return sched_queue.head->info;
+    pthread_mutex_lock(&pick_lock);
+    info = current_policy->pick();
+    pthread_mutex_unlock(&pick_lock);
+    return info;
 }
 
+/*
+ * Runs one scheduling step per timer expiry. Called from the scheduler
+ * thread, not from a signal handler (see scheduler_run).
+ */
 void timer_handler(int sig, siginfo_t *si, void *uc) {
     thread_info_t *info = NULL;
 
@@ -177,6 +252,12 @@ void timer_handler(int sig, siginfo_t *si, void *uc) {
         return;
     }
 
+    /* Let the current worker run on if the policy says so and it has work left */
+    if (currentThread && current_policy->tick(currentThread) && currentThread->quanta > 1) {
+        currentThread->quanta--;
+        return;
+    }
+
     /* Suspend the current worker */
     if (currentThread)
         suspend_worker(currentThread);
@@ -194,14 +275,15 @@ void timer_handler(int sig, siginfo_t *si, void *uc) {
 }
 
 /*
- * Set up the signal handlers for SIGALRM, SIGUSR1, and SIGTERM.
+ * Set up the signal handlers for SIGUSR1 and SIGTERM, and block SIGALRM.
+ * SIGALRM gets no handler: every thread created from here on inherits the
+ * mask, so the timer signal stays pending until the scheduler thread takes
+ * it with sigwaitinfo.
  */
 void setup_sig_handlers() {
-    /* Setup timer handler for SIGALRM signal in scheduler */
-    memset(&saction1, 0, sizeof(saction1));
-    saction1.sa_sigaction = timer_handler;
-    saction1.sa_flags = SA_SIGINFO;
-    sigaction(SIGALRM, &saction1, NULL);
+    sigemptyset(&alarm_set);
+    sigaddset(&alarm_set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alarm_set, NULL);
 
     /* Setup cancel handler for SIGTERM signal in workers */
     memset(&saction2, 0, sizeof(saction2));
@@ -223,12 +305,13 @@ void setup_sig_handlers() {
  ******************************************************************************/
 
 /*
- * Waits until there are workers in the scheduling queue.
+ * Waits until there are workers in the scheduling queue. Sleeps until
+ * enter_scheduler_queue inserts one instead of polling.
  */
 static void wait_for_queue() {
-    while (!list_size(&sched_queue)) {
+    if (!list_size(&sched_queue)) {
         printf("Scheduler: waiting for workers.\n");
-        sched_yield();
+        list_wait_nonempty(&sched_queue);
     }
 }
 
@@ -240,18 +323,58 @@ static void clean_up() {
      * Destroy any mutexes/condition variables/semaphores that were created.
      * Free any malloc'd memory not already free'd
      */
+    timer_delete(timer);
     sem_destroy(&queue_sem);
     pthread_mutex_destroy(&sched_queue.lock);
+    pthread_mutex_destroy(&pick_lock);
+    pthread_cond_destroy(&sched_queue.nonempty);
 }
 
 /*
  * Prints the program help message.
  */
 static void print_help(const char *progname) {
-    printf("usage: %s <num_threads> <queue_size> <i_1, i_2 ... i_numofthreads>\n", progname);
+    printf("usage: %s [-q quantum] [-m futex|signal] [-p policy] [-c cpus | -g carriers] <num_threads> <queue_size> <i_1, i_2 ... i_numofthreads>\n", progname);
+    printf("\tquantum: length of one time slice, e.g. 500us, 10ms or 1s (default 1s)\n");
+    printf("\tfutex|signal: park workers at safe points (default), or stop them with signals\n");
+    printf("\tpolicy: rr (default), mlfq[:s0,s1,...[/boost]], cfs[:latency[/min_slice]], srtf\n");
+    printf("\t\tor stride; slices, boost period and latency are in quanta\n");
+    printf("\tcpus: run that many round-robin schedulers, one run queue each (default 1)\n");
+    printf("\tcarriers: run workers as green threads on that many kernel threads\n");
     printf("\tnum_threads: the number of worker threads to run\n");
     printf("\tqueue_size: the number of threads that can be in the scheduler at one time\n");
-    printf("\ti_1, i_2 ...i_numofthreads: the number of quanta each worker thread runs\n");
+    printf("\ti_1, i_2 ...i_numofthreads: the number of quanta each worker thread runs,\n");
+    printf("\t\toptionally followed by @nice (-20..19, default 0) to weight it under cfs\n");
+    printf("\t\tand by :tickets (default 100) to weight it under stride\n");
+}
+
+/*
+ * Parses a duration such as "500us", "2ms" or "1.5s" (ns, us, ms or s; a
+ * bare number is seconds) into nanoseconds. Returns -1 if it is malformed
+ * or not positive.
+ */
+static long parse_duration(const char *text) {
+    char *unit;
+    double value = strtod(text, &unit);
+    double scale;
+
+    if (unit == text)
+        return -1;
+    if (!strcmp(unit, "ns"))
+        scale = 1;
+    else if (!strcmp(unit, "us"))
+        scale = 1e3;
+    else if (!strcmp(unit, "ms"))
+        scale = 1e6;
+    else if (!strcmp(unit, "s") || !*unit)
+        scale = 1e9;
+    else
+        return -1;
+
+    value *= scale;
+    if (value < 1 || value > 1e18)
+        return -1;
+    return (long)value;
 }
 
 /*
@@ -265,19 +388,22 @@ static void exit_error(int err_num) {
 /*
  * Creates the worker threads.
  */
-static void create_workers(int thread_count, int *quanta) {
+static void create_workers(int thread_count, int *quanta, int *nices, int *tickets) {
     int i = 0;
     int err = 0;
 
     for (i = 0; i < thread_count; i++) {
         thread_info_t *info = (thread_info_t *)malloc(sizeof(thread_info_t));
         info->quanta = quanta[i];
-
-        if ((err = pthread_create(&info->thrid, NULL, start_worker, (void *)info)) != 0) {
-            exit_error(err);
-        }
-        printf("Main: detaching worker thread %lu.\n", info->thrid);
-        pthread_detach(info->thrid);
+        info->turn = info->seen = 0;
+        info->preempt = PREEMPT_PARKED; /* until its first resume */
+        info->level = info->slice_used = 0;
+        info->epoch = 0;
+        info->response_time = -1;
+        info->nice = nices[i];
+        info->tickets = tickets[i];
+        info->cpu = 0;
+        info->pinned = -1;
 
         /* Initialize the time variables for each thread for performance evaluation */
         info->run_time = 0;
@@ -285,6 +411,12 @@ static void create_workers(int thread_count, int *quanta) {
 
         clock_gettime(CLOCK, &info->suspend_time);
         clock_gettime(CLOCK, &info->resume_time);
+
+        if ((err = pthread_create(&info->thrid, NULL, start_worker, (void *)info)) != 0) {
+            exit_error(err);
+        }
+        printf("Main: detaching worker thread %lu.\n", info->thrid);
+        pthread_detach(info->thrid);
     }
 }
 
@@ -292,10 +424,17 @@ static void create_workers(int thread_count, int *quanta) {
  * Runs the scheduler.
  */
 static void *scheduler_run(void *unused) {
+    /* With -c, per-CPU schedulers take over (see smp.c) */
+    if (smp_cpus > 1) {
+        smp_run(quantum_ns);
+        return NULL;
+    }
+
     // Initialize timerspec
     memset(&timerspec, 0, sizeof(struct itimerspec));
-    timerspec.it_value.tv_sec = QUANTUM;
-    timerspec.it_interval.tv_sec = QUANTUM;
+    timerspec.it_value.tv_sec = quantum_ns / 1000000000L;
+    timerspec.it_value.tv_nsec = quantum_ns % 1000000000L;
+    timerspec.it_interval = timerspec.it_value;
 
     wait_for_queue();
 
@@ -305,9 +444,17 @@ static void *scheduler_run(void *unused) {
         exit(EXIT_FAILURE);
     }
 
-    /* Keep the scheduler thread alive */
-    while (!quit)
-        sched_yield();
+    /* Sleep until the timer fires, then run one scheduling step */
+    while (!quit) {
+        siginfo_t si;
+        if (sigwaitinfo(&alarm_set, &si) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("sigwaitinfo");
+            exit(EXIT_FAILURE);
+        }
+        timer_handler(si.si_signo, &si, NULL);
+    }
 
     return NULL;
 }
@@ -332,42 +479,92 @@ static int start_scheduler(pthread_t *thrid) {
 int smp5_main(int argc, const char **argv) {
     int queue_size = 0;
     int ret_val = 0;
-    int *quanta, i;
+    int *quanta, *nices, *tickets, i;
     pthread_t sched_thread;
+    const char *progname = argv[0];
+
+    /* Options come first, ahead of the positional arguments */
+    while (argc > 2 && argv[1][0] == '-') {
+        int ok = 0;
+
+        if (!strcmp(argv[1], "-q")) {
+            ok = (quantum_ns = parse_duration(argv[2])) > 0;
+        } else if (!strcmp(argv[1], "-m")) {
+            ok = !strcmp(argv[2], "futex") || !strcmp(argv[2], "signal");
+            switch_mode = !strcmp(argv[2], "signal") ? SWITCH_SIGNAL : SWITCH_FUTEX;
+        } else if (!strcmp(argv[1], "-p")) {
+            ok = policy_chosen = (current_policy = find_policy(argv[2])) != NULL;
+        } else if (!strcmp(argv[1], "-c")) {
+            ok = (smp_cpus = atoi(argv[2])) >= 1 && smp_cpus <= SMP_MAX_CPUS;
+        } else if (!strcmp(argv[1], "-g")) {
+            ok = (green_carriers = atoi(argv[2])) >= 1;
+        }
+        if (!ok) {
+            print_help(progname);
+            exit(0);
+        }
+        argc -= 2;
+        argv += 2;
+    }
 
-    /* Check the arguments */
-    if (argc < 3) {
-        print_help(argv[0]);
+    /* Check the arguments; per-CPU queues and green threads are round robin only */
+    if (argc < 3 || ((smp_cpus > 1 || green_carriers) && current_policy != &rr_policy) ||
+        (smp_cpus > 1 && green_carriers)) {
+        print_help(progname);
         exit(0);
     }
 
     thread_count = atoi(argv[1]);
     queue_size = atoi(argv[2]);
     quanta = (int *)malloc(sizeof(int) * thread_count);
+    nices = (int *)malloc(sizeof(int) * thread_count);
+    tickets = (int *)malloc(sizeof(int) * thread_count);
     if (argc != 3 + thread_count) {
-        print_help(argv[0]);
+        print_help(progname);
         exit(0);
     }
 
-    for (i = 0; i < thread_count; i++)
+    for (i = 0; i < thread_count; i++) {
+        const char *at = strchr(argv[i + 3], '@');
+        const char *colon = strchr(argv[i + 3], ':');
+
         quanta[i] = atoi(argv[i + 3]);
+        nices[i] = at ? atoi(at + 1) : 0;
+        tickets[i] = colon ? atoi(colon + 1) : 100;
+        if (nices[i] < -20 || nices[i] > 19 || tickets[i] < 1) {
+            print_help(progname);
+            exit(0);
+        }
+    }
 
     printf("Main: running %d workers with queue size %d for quanta:\n", thread_count, queue_size);
     for (i = 0; i < thread_count; i++)
         printf(" %d", quanta[i]);
     printf("\n");
 
+    /* Green threads need none of the pthread machinery below */
+    if (green_carriers) {
+        if (queue_size < 1) {
+            print_help(progname);
+            exit(0);
+        }
+        green_run(thread_count, queue_size, quanta, quantum_ns);
+        return EXIT_SUCCESS;
+    }
+
     /* Setup the signal handlers for scheduler and workers */
     setup_sig_handlers();
 
     /* Initialize anything that needs to be done for the scheduler queue */
     init_sched_queue(queue_size);
+    if (smp_cpus > 1)
+        smp_init();
 
     /* Create a thread for the scheduler */
     start_scheduler(&sched_thread);
 
     /* Create the worker threads and returns */
-    create_workers(thread_count, quanta);
+    create_workers(thread_count, quanta, nices, tickets);
 
     /* Wait for scheduler to finish */
     printf("Main: waiting for scheduler %lu.\n", sched_thread);
@@ -380,6 +577,9 @@ int smp5_main(int argc, const char **argv) {
     pthread_exit(0);
 }
 
+/*
+ * Returns time1 - time2 in nanoseconds.
+ */
 long time_difference(const struct timespec *time1, const struct timespec *time2) {
-    return (time1->tv_sec - time2->tv_sec) * 1000000 + (time1->tv_nsec - time2->tv_nsec) / 1000;
+    return (time1->tv_sec - time2->tv_sec) * 1000000000L + (time1->tv_nsec - time2->tv_nsec);
 }
@@ -4,28 +4,63 @@
 #include <pthread.h> 
 #include <semaphore.h>
 #include "list.h"
+#include "rbtree.h"
 
-#define QUANTUM 1 
+#define QUANTUM_NS 1000000000L	/* default quantum (one second), in nanoseconds */
+
+/* How the scheduler stops and starts workers (-m) */
+typedef enum {
+	SWITCH_FUTEX,	/* preempt flag checked at safe points, futex park/unpark */
+	SWITCH_SIGNAL	/* SIGUSR1 to suspend, SIGUSR2 to resume, SIGTERM to cancel */
+} switch_mode_t;
+
+/* States of thread_info_t.preempt, moved between by CAS */
+#define PREEMPT_NONE	0	/* running, nothing asked */
+#define PREEMPT_PARK	1	/* scheduler asked for a park */
+#define PREEMPT_EXIT	2	/* scheduler asked for an exit */
+#define PREEMPT_PARKED	3	/* worker is parked, or committed to parking */
 
 /* typedefs */
 typedef struct thread_info {
 	pthread_t		thrid;
         int                     quanta;
-  	list_elem*		le;
+  	list_elem		le;	/* run queue link; le.info points back here */
+	int			turn;	/* futex word: bumped by every resume */
+	int			seen;	/* last turn the worker took (worker only) */
+	int			preempt; /* PREEMPT_*, polled at safe points */
+	/* policy bookkeeping (see policy.h) */
+	int			level;		/* mlfq: current level */
+	int			slice_used;	/* quanta run of the current slice */
+	unsigned		epoch;		/* mlfq: last boost seen */
+	list_elem		lvl_le;		/* mlfq: link in its level's queue */
+	int			nice;		/* -20..19, from "quanta@nice" */
+	long			vruntime;	/* cfs: weighted run time */
+	int			tickets;	/* stride: share, from "quanta:tickets" */
+	long			pass;		/* stride: next pass value */
+	rb_node			rb;		/* cfs, stride, srtf: run queue link */
+	list_elem		rq_le;		/* -c: link in its CPU's run queue */
+	int			cpu;		/* -c: CPU whose run queue holds it */
+	int			pinned;		/* -c: CPU its affinity is set to, or -1 */
 	/*added for evalution bookkeeping*/
 	struct timespec suspend_time;
 	struct timespec resume_time;
-	long wait_time;
-	long run_time;
+	long wait_time;		/* nanoseconds */
+	long run_time;		/* nanoseconds */
+	long response_time;	/* nanoseconds to first run, -1 before it */
 } thread_info_t;
 
 /* functions */
 void *start_worker(void *);
+void resume_worker(thread_info_t *info);
+void suspend_worker(thread_info_t *info);
+int workers_finished();
 long time_difference(const struct timespec*, const struct timespec*);
 int smp5_main(int argc, const char** argv);
 
 /* shared variables */
 extern sem_t		queue_sem;	/* semaphore for scheduler queue */
 extern thread_info_list sched_queue;	/* list of current workers */
+extern pthread_mutex_t	pick_lock;	/* held to pick, and to join sched_queue */
+extern switch_mode_t	switch_mode;	/* how workers are switched */
 
 #endif /* __SCHEDULER_H_ */
@@ -0,0 +1,274 @@
+// Bryan Duong
+// Edited date: 2024-11-22
+
+/*
+ * Multi-core mode (-c N). Each virtual CPU is a scheduler thread of its own
+ * with its own run queue, its own timer and its own current worker; it runs
+ * round robin over its queue exactly as the single scheduler does over
+ * sched_queue, and pins each worker it resumes to the matching real CPU.
+ *
+ * Workers join the least loaded queue. A CPU with nothing to run pulls a
+ * waiting worker from the busiest queue, and every BALANCE_TICKS quanta each
+ * CPU pulls one more if the busiest queue is at least two longer than its
+ * own. Only waiting workers move: a CPU's current worker stays put.
+ *
+ * Locking: a CPU's lock guards its queue's membership and its current
+ * worker. Pulling takes two CPU locks, lowest id first.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "smp.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define BALANCE_TICKS 4
+
+typedef struct cpu {
+	int			id;
+	pthread_t		thrid;
+	pthread_mutex_t		lock;
+	thread_info_list	rq;
+	thread_info_t		*current;
+	long			quantum_ns;
+	/* statistics */
+	long			quanta;		/* quanta a worker ran here */
+	int			pulled;		/* workers taken from other queues */
+	int			finished;	/* workers that ended here */
+	long			wait_time;	/* of those workers, ns */
+	long			run_time;
+} cpu_t;
+
+int smp_cpus = 1;
+static cpu_t *cpus;
+static int real_cpus[CPU_SETSIZE];	/* CPUs this process may use */
+static int real_count;
+
+void smp_init()
+{
+	cpu_set_t allowed;
+	int i;
+
+	cpus = (cpu_t *)calloc(smp_cpus, sizeof(cpu_t));
+	for (i = 0; i < smp_cpus; i++) {
+		cpus[i].id = i;
+		pthread_mutex_init(&cpus[i].lock, NULL);
+		pthread_mutex_init(&cpus[i].rq.lock, NULL);
+		pthread_cond_init(&cpus[i].rq.nonempty, NULL);
+	}
+
+	/* Virtual CPU i runs on the i-th CPU we may use, wrapping around */
+	real_count = 0;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+		for (i = 0; i < CPU_SETSIZE; i++)
+			if (CPU_ISSET(i, &allowed))
+				real_cpus[real_count++] = i;
+	}
+	if (!real_count)
+		real_cpus[real_count++] = 0;
+}
+
+void smp_enqueue(thread_info_t *info)
+{
+	cpu_t *cpu = &cpus[0];
+	int i;
+
+	for (i = 1; i < smp_cpus; i++)
+		if (list_size(&cpus[i].rq) < list_size(&cpu->rq))
+			cpu = &cpus[i];
+
+	pthread_mutex_lock(&cpu->lock);
+	info->cpu = cpu->id;
+	info->rq_le.info = info;
+	list_insert_tail(&cpu->rq, &info->rq_le);
+	pthread_mutex_unlock(&cpu->lock);
+}
+
+void smp_dequeue(thread_info_t *info)
+{
+	cpu_t *cpu = &cpus[info->cpu];
+
+	pthread_mutex_lock(&cpu->lock);
+	list_remove(&cpu->rq, &info->rq_le);
+	cpu->finished++;
+	cpu->wait_time += info->wait_time;
+	cpu->run_time += info->run_time;
+	pthread_mutex_unlock(&cpu->lock);
+}
+
+/*
+ * Moves one waiting worker from the busiest other queue to cpu's, if that
+ * queue is at least `margin` longer than cpu's. Returns whether it did.
+ */
+static int pull(cpu_t *cpu, int margin)
+{
+	cpu_t *busiest = NULL, *first, *second;
+	list_elem *le;
+	int i, size, most = 0, moved = 0;
+
+	for (i = 0; i < smp_cpus; i++) {
+		if (i != cpu->id && (size = list_size(&cpus[i].rq)) > most) {
+			busiest = &cpus[i];
+			most = size;
+		}
+	}
+	if (!busiest || most - list_size(&cpu->rq) < margin)
+		return 0;
+
+	first = cpu->id < busiest->id ? cpu : busiest;
+	second = first == cpu ? busiest : cpu;
+	pthread_mutex_lock(&first->lock);
+	pthread_mutex_lock(&second->lock);
+	for (le = busiest->rq.head; le; le = le->next) {
+		thread_info_t *info = le->info;
+
+		if (info != busiest->current) {
+			list_remove(&busiest->rq, le);
+			info->cpu = cpu->id;
+			list_insert_tail(&cpu->rq, le);
+			cpu->pulled++;
+			moved = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&second->lock);
+	pthread_mutex_unlock(&first->lock);
+	return moved;
+}
+
+/* Pins a worker to the real CPU behind cpu, unless it already is. */
+static void pin_worker(cpu_t *cpu, thread_info_t *info)
+{
+	cpu_set_t set;
+	int real = real_cpus[cpu->id % real_count];
+
+	if (info->pinned == real)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(real, &set);
+	if (pthread_setaffinity_np(info->thrid, sizeof(set), &set) == 0)
+		info->pinned = real;
+}
+
+/* One scheduling step: suspend the current worker, resume the next. */
+static void cpu_tick(cpu_t *cpu, long ticks)
+{
+	thread_info_t *info = cpu->current;
+
+	if (info) {
+		int alive = info->quanta > 1;
+
+		cpu->quanta++;
+		suspend_worker(info);	/* may cancel and free it */
+		pthread_mutex_lock(&cpu->lock);
+		if (alive)
+			list_move_tail(&cpu->rq, &info->rq_le);
+		cpu->current = NULL;
+		pthread_mutex_unlock(&cpu->lock);
+	}
+
+	if (ticks % BALANCE_TICKS == 0)
+		pull(cpu, 2);
+	if (!list_size(&cpu->rq))
+		pull(cpu, 1);
+
+	pthread_mutex_lock(&cpu->lock);
+	if (cpu->rq.head) {
+		info = cpu->rq.head->info;
+		cpu->current = info;
+	} else {
+		info = NULL;
+	}
+	pthread_mutex_unlock(&cpu->lock);
+
+	if (info) {
+		pin_worker(cpu, info);
+		resume_worker(info);
+	}
+}
+
+/* A CPU's scheduler: a timer aimed at this thread drives cpu_tick. */
+static void *cpu_run(void *arg)
+{
+	cpu_t *cpu = (cpu_t *)arg;
+	struct sigevent sevent;
+	struct itimerspec timerspec;
+	sigset_t alarm_set;
+	timer_t timer;
+	long ticks = 0;
+
+	sigemptyset(&alarm_set);
+	sigaddset(&alarm_set, SIGALRM);
+
+	memset(&sevent, 0, sizeof(sevent));
+	sevent.sigev_notify = SIGEV_THREAD_ID;
+	sevent.sigev_signo = SIGALRM;
+	sevent.sigev_notify_thread_id = syscall(SYS_gettid);
+	if (timer_create(CLOCK_MONOTONIC, &sevent, &timer) == -1) {
+		perror("timer_create");
+		exit(EXIT_FAILURE);
+	}
+	memset(&timerspec, 0, sizeof(timerspec));
+	timerspec.it_value.tv_sec = cpu->quantum_ns / 1000000000L;
+	timerspec.it_value.tv_nsec = cpu->quantum_ns % 1000000000L;
+	timerspec.it_interval = timerspec.it_value;
+	if (timer_settime(timer, 0, &timerspec, NULL) == -1) {
+		perror("timer_settime");
+		exit(EXIT_FAILURE);
+	}
+
+	while (!workers_finished()) {
+		siginfo_t si;
+
+		if (sigwaitinfo(&alarm_set, &si) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("sigwaitinfo");
+			exit(EXIT_FAILURE);
+		}
+		cpu_tick(cpu, ++ticks);
+	}
+
+	timer_delete(timer);
+	return NULL;
+}
+
+void smp_run(long quantum_ns)
+{
+	int i;
+
+	for (i = 0; i < smp_cpus; i++) {
+		cpus[i].quantum_ns = quantum_ns;
+		if (pthread_create(&cpus[i].thrid, NULL, cpu_run, &cpus[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < smp_cpus; i++)
+		pthread_join(cpus[i].thrid, NULL);
+
+	for (i = 0; i < smp_cpus; i++) {
+		cpu_t *cpu = &cpus[i];
+
+		printf("CPU %d: ran %ld quanta, pulled %d workers, finished %d", i,
+		       cpu->quanta, cpu->pulled, cpu->finished);
+		if (cpu->finished)
+			printf(", average wait %f seconds, average run %f seconds",
+			       (double)cpu->wait_time / 1e9 / cpu->finished,
+			       (double)cpu->run_time / 1e9 / cpu->finished);
+		printf(".\n");
+	}
+}
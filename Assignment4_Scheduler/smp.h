@@ -0,0 +1,19 @@
+#ifndef __SMP_H_
+#define __SMP_H_
+
+#include "scheduler.h"
+
+#define SMP_MAX_CPUS 1024
+
+extern int smp_cpus;	/* virtual CPUs (-c); 1 runs the single scheduler */
+
+/* Sets up smp_cpus run queues; call before any worker starts. */
+void smp_init();
+/* Puts a worker joining the scheduler on the least loaded CPU's run queue. */
+void smp_enqueue(thread_info_t *info);
+/* Takes a finished worker off its CPU's run queue. */
+void smp_dequeue(thread_info_t *info);
+/* Runs one scheduler per CPU until every worker is done, then reports. */
+void smp_run(long quantum_ns);
+
+#endif /* __SMP_H_ */
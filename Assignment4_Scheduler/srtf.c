@@ -0,0 +1,72 @@
+// Bryan Duong
+// Edited date: 2024-11-22
+
+/*
+ * Shortest remaining time first. Every worker declares its demand up front
+ * (its quanta), so the scheduler knows exactly how much each has left: the
+ * next worker is the one with the fewest quanta remaining, and the running
+ * worker is preempted as soon as a waiting one has fewer left than it will
+ * after this quantum. Among equals the queue order (round robin) decides.
+ * This minimizes the average wait, at the cost of starving long workers
+ * while shorter ones keep arriving.
+ *
+ * Workers sit in a red-black tree keyed by quanta remaining, as under cfs.
+ * Only the running worker's key changes, so tick re-keys just that one.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "policy.h"
+
+static rb_tree tree;
+static pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define rb_info(node) ((thread_info_t *)((char *)(node) - offsetof(thread_info_t, rb)))
+
+static void srtf_enqueue(thread_info_t *info)
+{
+	pthread_mutex_lock(&tree_lock);
+	info->rb.key = info->quanta;
+	rb_insert(&tree, &info->rb);
+	pthread_mutex_unlock(&tree_lock);
+}
+
+static void srtf_dequeue(thread_info_t *info)
+{
+	pthread_mutex_lock(&tree_lock);
+	rb_erase(&tree, &info->rb);
+	pthread_mutex_unlock(&tree_lock);
+}
+
+static int srtf_tick(thread_info_t *info)
+{
+	int keep;
+
+	/*
+	 * The scheduler takes this quantum off info->quanta whether or not the
+	 * worker keeps the CPU, so key it by what it will have left. Reinserting
+	 * puts it behind equal keys, which is the round robin among equals.
+	 */
+	pthread_mutex_lock(&tree_lock);
+	rb_erase(&tree, &info->rb);
+	info->rb.key = info->quanta - 1;
+	rb_insert(&tree, &info->rb);
+	keep = rb_first(&tree)->key >= info->rb.key;
+	pthread_mutex_unlock(&tree_lock);
+
+	return keep;
+}
+
+static thread_info_t *srtf_pick(void)
+{
+	rb_node *first;
+
+	pthread_mutex_lock(&tree_lock);
+	first = rb_first(&tree);
+	pthread_mutex_unlock(&tree_lock);
+	return first ? rb_info(first) : NULL;
+}
+
+sched_policy_t srtf_policy = { "srtf", NULL, srtf_enqueue, srtf_dequeue, srtf_tick, srtf_pick, NULL };
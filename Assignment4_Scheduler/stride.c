@@ -0,0 +1,120 @@
+// Bryan Duong
+// Edited date: 2024-11-22
+
+/*
+ * Stride scheduling: deterministic proportional share. A worker with t
+ * tickets has a stride of STRIDE1 / t, and each quantum it runs advances
+ * its pass by that stride. Every quantum goes to the worker with the
+ * smallest pass, so over any stretch the quanta each worker gets are
+ * proportional to its tickets, within one quantum.
+ *
+ * Workers sit in a red-black tree keyed by pass, as under cfs. A new
+ * worker starts one stride past the global pass, which advances by
+ * STRIDE1 / (total tickets) per quantum, so it joins in step with the
+ * workers already there.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "policy.h"
+
+#define STRIDE1		(1L << 20)
+#define MAX_GROUPS	16	/* distinct ticket counts reported */
+
+static rb_tree tree;
+static long total_tickets;
+static long global_pass;
+static pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Per ticket count, for the report */
+static int groups;
+static int tickets_of[MAX_GROUPS];
+static int workers_of[MAX_GROUPS];
+static long quanta_of[MAX_GROUPS];
+static long turnaround_of[MAX_GROUPS];	/* nanoseconds */
+
+#define rb_info(node) ((thread_info_t *)((char *)(node) - offsetof(thread_info_t, rb)))
+
+/* The report row for a ticket count, or -1 once the table is full. */
+static int group_of(int tickets)
+{
+	int i;
+
+	for (i = 0; i < groups; i++)
+		if (tickets_of[i] == tickets)
+			return i;
+	if (groups == MAX_GROUPS)
+		return -1;
+	tickets_of[groups] = tickets;
+	return groups++;
+}
+
+static void stride_enqueue(thread_info_t *info)
+{
+	pthread_mutex_lock(&tree_lock);
+	info->pass = global_pass + STRIDE1 / info->tickets;
+	info->rb.key = info->pass;
+	rb_insert(&tree, &info->rb);
+	total_tickets += info->tickets;
+	pthread_mutex_unlock(&tree_lock);
+}
+
+static void stride_dequeue(thread_info_t *info)
+{
+	int g;
+
+	pthread_mutex_lock(&tree_lock);
+	rb_erase(&tree, &info->rb);
+	total_tickets -= info->tickets;
+	if ((g = group_of(info->tickets)) >= 0) {
+		workers_of[g]++;
+		turnaround_of[g] += info->wait_time + info->run_time;
+	}
+	pthread_mutex_unlock(&tree_lock);
+}
+
+static int stride_tick(thread_info_t *info)
+{
+	int g, keep;
+
+	pthread_mutex_lock(&tree_lock);
+	if ((g = group_of(info->tickets)) >= 0)
+		quanta_of[g]++;
+	global_pass += STRIDE1 / total_tickets;
+	rb_erase(&tree, &info->rb);
+	info->pass += STRIDE1 / info->tickets;
+	info->rb.key = info->pass;
+	rb_insert(&tree, &info->rb);
+	/* Keep the CPU only while still the smallest pass */
+	keep = rb_first(&tree) == &info->rb;
+	pthread_mutex_unlock(&tree_lock);
+
+	return keep;
+}
+
+static thread_info_t *stride_pick(void)
+{
+	rb_node *first;
+
+	pthread_mutex_lock(&tree_lock);
+	first = rb_first(&tree);
+	pthread_mutex_unlock(&tree_lock);
+	return first ? rb_info(first) : NULL;
+}
+
+static void stride_report(void)
+{
+	int i;
+
+	for (i = 0; i < groups; i++) {
+		if (!workers_of[i])
+			continue;
+		printf("Stride %d tickets: %d workers ran %ld quanta, average turnaround %f seconds.\n",
+		       tickets_of[i], workers_of[i], quanta_of[i],
+		       (double)turnaround_of[i] / 1e9 / workers_of[i]);
+	}
+}
+
+sched_policy_t stride_policy = { "stride", NULL, stride_enqueue, stride_dequeue, stride_tick, stride_pick, stride_report };
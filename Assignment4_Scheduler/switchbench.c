@@ -0,0 +1,133 @@
+// Bryan Duong
+// Edited date: 2024-11-22
+
+/*
+ * Context-switch latency: two threads hand a turn back and forth, once with
+ * the scheduler's old SIGUSR1/SIGUSR2 handshake and once with futex
+ * park/unpark (see park.h), and the mean one-way handoff is printed. For
+ * green mode (-g), the same for two user contexts on one thread, switched
+ * with swapcontext and with green.c's own switch.
+ *
+ * usage: switchbench [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include "park.h"
+#include "green.h"
+
+static long rounds = 100000;
+static pthread_t ping_thr, pong_thr;
+static int turns[2], seen[2];
+static sigset_t usr2_set;
+static ucontext_t main_ctx, partner_ctx;
+
+static long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* SIGUSR1 handler: the worker's suspend_thread, minus the printing */
+static void suspended(int sig) {
+	int got;
+	sigwait(&usr2_set, &got);
+}
+
+/*
+ * Signal handshake. As in the scheduler, the side giving up the CPU is
+ * stopped with SIGUSR1 and waits in the handler for SIGUSR2; here each side
+ * stops itself and resumes the other.
+ */
+static void *signal_side(void *arg) {
+	pthread_t other;
+	long i;
+
+	if (arg)
+		raise(SIGUSR1);		/* pong starts suspended, until ping exists */
+	other = arg ? ping_thr : pong_thr;
+	for (i = 0; i < rounds; i++) {
+		pthread_kill(other, SIGUSR2);
+		raise(SIGUSR1);
+	}
+	if (!arg)
+		pthread_kill(other, SIGUSR2);	/* pong's last suspension */
+	return NULL;
+}
+
+/* Futex handshake: unpark the other side, park until it hands back. */
+static void *futex_side(void *arg) {
+	int me = arg != NULL, other = !me;
+	long i;
+
+	if (me)
+		park_until_turn(&turns[me], &seen[me]);
+	for (i = 0; i < rounds; i++) {
+		unpark(&turns[other]);
+		park_until_turn(&turns[me], &seen[me]);
+	}
+	if (!me)
+		unpark(&turns[other]);
+	return NULL;
+}
+
+/* swapcontext partner: hands straight back, forever */
+static void partner(void) {
+	for (;;)
+		swapcontext(&partner_ctx, &main_ctx);
+}
+
+/* Mean one-way swapcontext between two contexts of this thread, in ns. */
+static double measure_ucontext(void) {
+	static char stack[16 * 1024];
+	long i, start;
+
+	getcontext(&partner_ctx);
+	partner_ctx.uc_stack.ss_sp = stack;
+	partner_ctx.uc_stack.ss_size = sizeof(stack);
+	makecontext(&partner_ctx, partner, 0);
+	start = now_ns();
+	for (i = 0; i < rounds; i++)
+		swapcontext(&main_ctx, &partner_ctx);
+	return (double)(now_ns() - start) / (2 * rounds);
+}
+
+/* Runs one handshake and returns the mean one-way handoff in ns. */
+static double measure(void *(*side)(void *)) {
+	long start = now_ns();
+
+	pthread_create(&pong_thr, NULL, side, (void *)1);
+	pthread_create(&ping_thr, NULL, side, NULL);
+	pthread_join(ping_thr, NULL);
+	pthread_join(pong_thr, NULL);
+	return (double)(now_ns() - start) / (2 * rounds);
+}
+
+int main(int argc, char **argv) {
+	struct sigaction sa;
+
+	if (argc > 1 && (rounds = atol(argv[1])) < 1) {
+		fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	/* SIGUSR2 is only ever taken by sigwait */
+	sigemptyset(&usr2_set);
+	sigaddset(&usr2_set, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &usr2_set, NULL);
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = suspended;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	printf("signal handoff:  %.0f ns\n", measure(signal_side));
+	printf("futex handoff:   %.0f ns\n", measure(futex_side));
+	printf("ucontext switch: %.0f ns\n", measure_ucontext());
+	printf("green switch:    %.0f ns\n", green_switch_ns(rounds));
+	return 0;
+}
@@ -8,6 +8,9 @@
 #include <signal.h>
 
 #include "scheduler.h"
+#include "park.h"
+#include "policy.h"
+#include "smp.h"
 
 
 /*******************************************************************************
@@ -43,6 +46,53 @@ void suspend_thread()
 	printf("Thread %u: resuming.\n",(unsigned int) pthread_self());
 }
 
+/* The scheduler is done with info; it is ours to free */
+static void exit_thread(thread_info_t *info)
+{
+	free(info);
+	cancel_thread();
+}
+
+/*
+ * Futex counterpart of suspend_thread: gives up the CPU until the scheduler
+ * resumes this worker. Runs at a safe point, not in a signal handler, once
+ * preempt is PREEMPT_PARKED; only the scheduler moves it on from there.
+ */
+static void park_thread(thread_info_t *info)
+{
+	printf("Thread %u: suspending.\n", (unsigned int)pthread_self());
+
+	park_until_turn(&info->turn, &info->seen);
+	if (__atomic_load_n(&info->preempt, __ATOMIC_ACQUIRE) == PREEMPT_EXIT)
+		exit_thread(info);
+
+	printf("Thread %u: resuming.\n", (unsigned int)pthread_self());
+}
+
+/*
+ * Safe point: acts on whatever the scheduler asked for since the last one.
+ * A single load when nothing is pending.
+ */
+static void preemption_point(thread_info_t *info)
+{
+	int req = __atomic_load_n(&info->preempt, __ATOMIC_ACQUIRE);
+
+	if (req == PREEMPT_NONE)
+		return;
+	/*
+	 * Commit to the park; the scheduler may have withdrawn it (resume) or
+	 * replaced it (cancel) in the meantime.
+	 */
+	if (req == PREEMPT_PARK &&
+	    __atomic_compare_exchange_n(&info->preempt, &req, PREEMPT_PARKED, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		park_thread(info);
+		return;
+	}
+	if (req == PREEMPT_EXIT)
+		exit_thread(info);
+}
+
 /*******************************************************************************
  *
  * 
@@ -55,16 +105,21 @@ static int enter_scheduler_queue(thread_info_t *info)
 {
 	/*
 	 * wait for available room in queue.
-	 * create a new list entry for this thread
-	 * store this thread info in the new entry.
+	 * link this thread's embedded list entry in; nothing is allocated.
+	 * A pick must never find us in the policy, or on a CPU's run queue,
+	 * before we are in sched_queue.
 	 */
 	sem_wait(&queue_sem);
-	list_elem *item = (list_elem*)malloc(sizeof(list_elem));
-	info->le = item;
-	item->info = info;
-	item->prev = 0;
-	item->next = 0;
-	list_insert_tail(&sched_queue, item);
+	info->le.info = info;
+	info->le.prev = 0;
+	info->le.next = 0;
+	pthread_mutex_lock(&pick_lock);
+	list_insert_tail(&sched_queue, &info->le);
+	if (current_policy->enqueue)
+		current_policy->enqueue(info);
+	pthread_mutex_unlock(&pick_lock);
+	if (smp_cpus > 1)
+		smp_enqueue(info);
 	return 0;
 }
 
@@ -76,12 +131,16 @@ void leave_scheduler_queue(thread_info_t *info)
 	printf("Thread %lu: leaving scheduler queue.\n", info->thrid);
 	/*
 	 * remove the given worker from queue
-	 * clean up the memory that we malloc'd for the list
-	 * clean up the memory that was passed to us
+	 * clean up the memory that was passed to us (the list entry is part of it);
+	 * a futex-switched worker still polls info, so it frees it on its way out
 	 */
-	list_remove(&sched_queue, info->le);
-	free(info->le);
-	free(info);
+	if (smp_cpus > 1)
+		smp_dequeue(info);
+	if (current_policy->dequeue)
+		current_policy->dequeue(info);
+	list_remove(&sched_queue, &info->le);
+	if (switch_mode == SWITCH_SIGNAL)
+		free(info);
 }
 
 
@@ -117,12 +176,17 @@ void *start_worker(void *arg)
 	}
 	printf("Thread %lu: in scheduler queue.\n", info->thrid);
 
-	suspend_thread();
+	if (switch_mode == SWITCH_SIGNAL)
+		suspend_thread();
+	else
+		park_thread(info);
 
 	while (1) {
 		/* do some meaningless work... */
 		for (j = 0; j < 10000000; j++) {
 			calc = 4.0 * calc * (1.0 - calc);
+			if ((j & 0x3fff) == 0 && switch_mode == SWITCH_FUTEX)
+				preemption_point(info);
 		}
 	}
 }